@@ -16,12 +16,21 @@
  * unidentifiable. 
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
 #include <getopt.h>
 #include <time.h>
+#include <pthread.h>
 #include "tree.h"
 #include "mylib.h"
+#include "suggest.h"
+#include "server.h"
+#include "spill.h"
+#include "input.h"
 
 /**
  * Define: 
@@ -30,16 +39,441 @@
  */
 #define WORD_SIZE 256
 
+/**
+ * Define:
+ * The most spelling suggestions printed for an unknown word with -e.
+ */
+#define SUGGESTIONS 5
+
+/**
+ * Define:
+ * CACHE_SIZE is the number of entries in the hot-word cache used by -c,
+ * which must be a power of two, and CACHE_WORD the longest word an entry
+ * can hold. Longer words are always looked up in the tree.
+ */
+#define CACHE_SIZE 16384
+#define CACHE_WORD 30
+
+/**
+ * Define:
+ * The size of the buffer the listing of words is collected in before it is
+ * written to stdout.
+ */
+#define LISTING_SIZE (1 << 16)
+
+/**
+ * The hot-word cache remembers whether recently checked words were in the
+ * dictionary. Real text uses a small number of words over and over, and
+ * finding one of those in the cache is much quicker than searching the
+ * tree for it again. Each word can only go in one entry, chosen by its
+ * hash, and replaces whatever word was there. An entry is 32 bytes, and
+ * has a length of 0 while it is empty.
+ */
+struct cache_entry {
+    unsigned char len;
+    unsigned char known;
+    char word[CACHE_WORD];
+};
+
+struct lookup_cache {
+    struct cache_entry *entries;
+    long hits;
+    long misses;
+};
+
+/**
+ * The listing printed by print_info() goes through this writer, which
+ * formats each line itself instead of calling printf() for it.
+ */
+static writer listing;
+
 /**
  * Function:
  * This function is passed as a parameter to the tree_preorder method and 
- * prints the result of the program.
+ * prints the result of the program, in the same form as
+ * printf("%-4d %s\n").
  * @param int frequency to detect frequency of a word
  * @param char *word, a string for the word to print 
  */
 
 static void print_info(int freq, char *word) {
-    printf("%-4d %s\n", freq, word);
+    writer_int(listing, freq, 4);
+    writer_char(listing, ' ');
+    writer_str(listing, word);
+    writer_char(listing, '\n');
+}
+
+/**
+ * Function:
+ * Prints the usage message for the program to stderr.
+ * @param char *progname, the name the program was run as
+ */
+
+static void print_usage(char *progname) {
+    fprintf(stderr, "Usage: %s [OPTION]... [FILE]...\n", progname);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Perform various operations using a binary tree. By default, words\nare read from stdin and added to the tree, before being printed out\nalongside their frequencies to stdout.\n\n");
+    fprintf(stderr, "Words are read from each FILE in turn instead if any are given, or\nfrom every file under FILE if it is a directory, and - is stdin.\nFiles compressed with gzip are decompressed as they are read.\n\n");
+    fprintf(stderr, "-a PREFIX\tOnly print the words starting with PREFIX in sorted\n\t\torder, or the K most frequent of them if -k given\n");
+    fprintf(stderr, "-b\t\tRead every word before building the tree, which is then\n\t\tperfectly balanced (ignore -j)\n");
+    fprintf(stderr, "-c FILENAME\tCheck the spelling of words in FILENAME, which can be\n\t\ta directory or compressed like FILE, using words read\n\t\tfrom the input as the dictionary. Print timing info\n\t\t& unknown words to stderr (ignore -d & -o)\n");
+    fprintf(stderr, "-d\t\tOnly print the tree depth (ignore -o)\n");
+    fprintf(stderr, "-e DISTANCE\tWith -c, follow each unknown word with up to %d\n\t\tsuggestions within DISTANCE (1 or 2) edits, closest\n\t\tand then most frequent first (ignore -j)\n", SUGGESTIONS);
+    fprintf(stderr, "-f FILENAME\tWrite DOT output to FILENAME (if -o given)\n");
+    fprintf(stderr, "-i, --sorted\tPrint the words in sorted order instead of preorder\n");
+    fprintf(stderr, "-j THREADS\tFill the tree, and check spelling if -c given, using\n\t\tTHREADS threads (default 1)\n");
+    fprintf(stderr, "-k, --top K\tOnly print the K most frequent words, most frequent\n\t\tfirst\n");
+    fprintf(stderr, "-l FILENAME\tLoad the tree from the snapshot FILENAME instead of\n\t\treading words from stdin (ignore -j, -r & -t)\n");
+    fprintf(stderr, "-m, --stats FORMAT\n\t\tPrint counts of the work done in each phase to stderr\n\t\tas 'text' or 'json' (needs a build with -DSTATS)\n");
+    fprintf(stderr, "-n\t\tDon't cache the words looked up by -c\n");
+    fprintf(stderr, "-o\t\tOutput the tree in DOT form to file 'tree-view.dot'\n");
+    fprintf(stderr, "-p, --serve SOCKET\n\t\tServe requests about the tree on the Unix domain socket\n\t\tSOCKET until interrupted (ignore -a, -c, -d, -i, -k & -o)\n");
+    fprintf(stderr, "-r\t\tMake the tree an RBT (the default is a BST)\n");
+    fprintf(stderr, "-s FILENAME\tSave a snapshot of the tree to FILENAME, which can be\n\t\tloaded later with -l\n");
+    fprintf(stderr, "-t\t\tUse a hash table instead of a tree, words are\n\t\tprinted in sorted order\n");
+    fprintf(stderr, "-u FILENAME\tUpdate the tree from FILENAME, where each line is a\n\t\t'+' followed by words to add, a '-' followed by words\n\t\tto remove one occurrence of, or a '!' followed by\n\t\twords to delete outright\n");
+    fprintf(stderr, "-x, --spill MEGABYTES\n\t\tKeep the tree within MEGABYTES of memory by writing it\n\t\tto temporary files whenever it grows too big, then\n\t\tmerge them to print the words in sorted order (ignore\n\t\t-a, -b, -c, -d, -f, -j, -k, -l, -o, -p, -s & -u)\n");
+    fprintf(stderr, "-z, --no-freeze\tDon't lay the tree out for fast searching before\n\t\tchecking spelling with -c\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "-h\t\tPrint this message\n");
+}
+
+/**
+ * Function:
+ * Returns the current wall clock time in seconds. clock() adds together the
+ * CPU time of every thread, so it can't be used to time a parallel fill.
+ * @return the time in seconds from an arbitrary fixed point
+ */
+
+static double wall_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct lookup_cache *cache_new(void) {
+    struct lookup_cache *c = emalloc(sizeof *c);
+    c->entries = emalloc(CACHE_SIZE * sizeof c->entries[0]);
+    memset(c->entries, 0, CACHE_SIZE * sizeof c->entries[0]);
+    c->hits = 0;
+    c->misses = 0;
+    return c;
+}
+
+static void cache_free(struct lookup_cache *c) {
+    if (c != NULL) {
+        free(c->entries);
+        free(c);
+    }
+}
+
+/**
+ * Function:
+ * Looks a word up in the dictionary, going through the hot-word cache if
+ * there is one and counting whether the word was found in it.
+ * @param struct lookup_cache *c, the cache, or NULL to search the tree
+ * @param tree t, the dictionary
+ * @param char *word, the word to look up
+ * @param int len, the length of the word
+ * @return 1 if the word is in the dictionary, 0 otherwise
+ */
+
+static int cache_search(struct lookup_cache *c, tree t, char *word, int len) {
+    struct cache_entry *e;
+    unsigned int h = 2166136261u;
+    int i;
+    if (NULL == c) {
+        return tree_search(t, word);
+    }
+    if (len > CACHE_WORD) {
+        c->misses++;
+        return tree_search(t, word);
+    }
+    for (i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)word[i]) * 16777619u;
+    }
+    e = &c->entries[(h ^ (h >> 16)) & (CACHE_SIZE - 1)];
+    if (e->len == len && memcmp(e->word, word, len) == 0) {
+        c->hits++;
+        return e->known;
+    }
+    c->misses++;
+    e->len = len;
+    memcpy(e->word, word, len);
+    e->known = tree_search(t, word);
+    return e->known;
+}
+
+/**
+ * Function:
+ * Reads every word of the input and builds a tree of them all at once
+ * with tree_build(), rather than inserting them as they are read. The
+ * words are kept in an arena until the tree has been built.
+ * @param tree_t type, the kind of tree to build
+ * @param input in, the input to read words from
+ * @return the new tree
+ */
+
+static tree bulk_fill(tree_t type, input in) {
+    arena words = arena_new(1 << 20);
+    char **list = emalloc(1024 * sizeof list[0]);
+    int size = 1024;
+    int n = 0;
+    char *word;
+    tree t;
+
+    while (input_next(in, &word) != EOF) {
+        if (n == size) {
+            size *= 2;
+            list = erealloc(list, size * sizeof list[0]);
+        }
+        list[n++] = arena_strdup(words, word);
+    }
+    t = tree_build(type, list, n);
+    free(list);
+    words = arena_free(words);
+    return t;
+}
+
+/**
+ * Function:
+ * Applies a file of updates to a tree in place. Each line starts with '+'
+ * to add the words on the rest of the line, '-' to remove one occurrence of
+ * each, or '!' to delete each outright. Words are read from the rest of the
+ * line exactly as they are from the input, and blank lines are skipped.
+ * @param tree t, the tree to update
+ * @param FILE *stream, the stream to read updates from
+ * @param char *filename, the name of the stream for error messages
+ * @return 0 on success, or EOF if a line did not start with '+', '-' or '!'
+ */
+
+static int apply_updates(tree t, FILE *stream, char *filename) {
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    int lineno = 0;
+    tokenizer tk;
+    char *word;
+
+    while ((len = getline(&line, &size, stream)) != -1) {
+        lineno++;
+        if (len == 0 || '\n' == line[0]) {
+            continue;
+        }
+        if (line[0] != '+' && line[0] != '-' && line[0] != '!') {
+            fprintf(stderr, "Bad update on line %d of %s\n", lineno, filename);
+            free(line);
+            return EOF;
+        }
+        tk = tokenizer_new(line + 1, len - 1, WORD_SIZE);
+        while (tokenizer_next(tk, &word) != EOF) {
+            if ('+' == line[0]) {
+                tree_insert(t, word);
+            } else if ('-' == line[0]) {
+                tree_decrement(t, word);
+            } else {
+                tree_delete(t, word);
+            }
+        }
+        tk = tokenizer_free(tk);
+    }
+    free(line);
+    return 0;
+}
+
+/**
+ * Function:
+ * Finds where the chunk of text which should end at pos really ends. Chunks
+ * are only ever cut between words, so pos is moved forward past any word
+ * characters, where a word character is one getword() would keep reading.
+ * @param char *text, the text being cut into chunks
+ * @param size_t len, the length of the text
+ * @param size_t pos, the position the chunk would ideally end at
+ * @return the position of the first non-word character at or after pos
+ */
+
+static size_t chunk_end(char *text, size_t len, size_t pos) {
+    while (pos < len && (isalnum((unsigned char)text[pos]) || '\'' == text[pos])) {
+        pos++;
+    }
+    return pos;
+}
+
+/**
+ * A fill job is one thread's share of a parallel fill. The thread builds
+ * its own tree from the words in text, and later merges the tree of
+ * another job into it.
+ */
+struct fill_job {
+    tokenizer tk;
+    tree t;
+    tree merge_from;
+};
+
+static void *fill_worker(void *arg) {
+    struct fill_job *job = arg;
+    char *word;
+    while (tokenizer_next(job->tk, &word) != EOF) {
+        tree_insert(job->t, word);
+    }
+    job->tk = tokenizer_free(job->tk);
+    return NULL;
+}
+
+static void *merge_worker(void *arg) {
+    struct fill_job *job = arg;
+    tree_merge(job->t, job->merge_from);
+    job->merge_from = tree_free(job->merge_from);
+    return NULL;
+}
+
+/**
+ * Function:
+ * Builds a tree from the words of the input using several threads. The
+ * input is read into memory and cut into one chunk per thread, only ever
+ * between words so that every word is read exactly as it would be from the
+ * whole input. Each thread fills a tree of its own, then the trees
+ * are merged together in pairs, in parallel, until only one is left. The
+ * frequencies of words which appear in more than one chunk are summed.
+ * @param tree_t type, the kind of tree to build
+ * @param int threads, the number of threads to use
+ * @param input in, the input to read words from
+ * @return a tree holding every word of the input
+ */
+
+static tree parallel_fill(tree_t type, int threads, input in) {
+    struct fill_job *jobs = emalloc(threads * sizeof jobs[0]);
+    pthread_t *ids = emalloc(threads * sizeof ids[0]);
+    size_t len, start = 0, end;
+    char *text = input_read(in, &len);
+    int i, step;
+    tree result;
+
+    for (i = 0; i < threads; i++) {
+        end = (i == threads - 1) ? len : len / threads * (i + 1);
+        end = chunk_end(text, len, end < start ? start : end);
+        jobs[i].tk = tokenizer_new(text + start, end - start, WORD_SIZE);
+        jobs[i].t = tree_new(type);
+        jobs[i].merge_from = NULL;
+        start = end;
+        if (pthread_create(&ids[i], NULL, fill_worker, &jobs[i]) != 0) {
+            fprintf(stderr, "Failed to create thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (i = 0; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+    }
+
+    for (step = 1; step < threads; step *= 2) {
+        for (i = 0; i + step < threads; i += 2 * step) {
+            jobs[i].merge_from = jobs[i + step].t;
+            if (pthread_create(&ids[i], NULL, merge_worker, &jobs[i]) != 0) {
+                fprintf(stderr, "Failed to create thread\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        for (i = 0; i + step < threads; i += 2 * step) {
+            pthread_join(ids[i], NULL);
+        }
+    }
+
+    result = jobs[0].t;
+    free(jobs);
+    free(ids);
+    free(text);
+    return result;
+}
+
+/**
+ * A check job is one thread's share of a parallel spell check. The thread
+ * looks up each word in its chunk of text and collects the unknown words
+ * in its own output buffer, so they can be printed in their original order
+ * once every thread has finished.
+ */
+struct check_job {
+    tokenizer tk;
+    tree t;
+    struct lookup_cache *cache;
+    char *out;
+    size_t out_len;
+    size_t out_size;
+    int unknown;
+};
+
+static void *check_worker(void *arg) {
+    struct check_job *job = arg;
+    char *word;
+    int n;
+    while ((n = tokenizer_next(job->tk, &word)) != EOF) {
+        if (cache_search(job->cache, job->t, word, n) == 0) {
+            if (job->out_len + n + 1 > job->out_size) {
+                job->out_size = 2 * (job->out_size + n + 1);
+                job->out = erealloc(job->out, job->out_size);
+            }
+            memcpy(job->out + job->out_len, word, n);
+            job->out[job->out_len + n] = '\n';
+            job->out_len += n + 1;
+            job->unknown++;
+        }
+    }
+    job->tk = tokenizer_free(job->tk);
+    return NULL;
+}
+
+/**
+ * Function:
+ * Spell checks the words of the input against a tree using several
+ * threads. The input is read into memory and cut into one chunk per
+ * thread between words. Unknown words are printed to stdout in the same
+ * order as they appear in the input. Each thread has a hot-word cache of
+ * its own, whose counts are added to those of c.
+ * @param tree t, the dictionary, which is only read
+ * @param int threads, the number of threads to use
+ * @param input in, the input of words to check
+ * @param struct lookup_cache *c, the cache, or NULL to use none
+ * @return the number of unknown words
+ */
+
+static int parallel_check(tree t, int threads, input in, struct lookup_cache *c) {
+    struct check_job *jobs = emalloc(threads * sizeof jobs[0]);
+    pthread_t *ids = emalloc(threads * sizeof ids[0]);
+    size_t len, start = 0, end;
+    char *text = input_read(in, &len);
+    int i, unknown = 0;
+
+    for (i = 0; i < threads; i++) {
+        end = (i == threads - 1) ? len : len / threads * (i + 1);
+        end = chunk_end(text, len, end < start ? start : end);
+        jobs[i].tk = tokenizer_new(text + start, end - start, WORD_SIZE);
+        jobs[i].t = t;
+        jobs[i].cache = (NULL == c) ? NULL : cache_new();
+        jobs[i].out = NULL;
+        jobs[i].out_len = 0;
+        jobs[i].out_size = 0;
+        jobs[i].unknown = 0;
+        start = end;
+        if (pthread_create(&ids[i], NULL, check_worker, &jobs[i]) != 0) {
+            fprintf(stderr, "Failed to create thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (i = 0; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+        fwrite(jobs[i].out, 1, jobs[i].out_len, stdout);
+        unknown += jobs[i].unknown;
+        if (c != NULL) {
+            c->hits += jobs[i].cache->hits;
+            c->misses += jobs[i].cache->misses;
+            cache_free(jobs[i].cache);
+        }
+        free(jobs[i].out);
+    }
+
+    free(jobs);
+    free(ids);
+    free(text);
+    return unknown;
 }
 
 /**
@@ -48,7 +482,7 @@ static void print_info(int freq, char *word) {
  * words provided as input from a text file are read from stdin and included 
  * in the tree before being displayed adjacent to their respective word input 
  * and their frequency of occurrence. Words are read as input in this function 
- * using the getword() function in the mylib.h file and memory for reading 
+ * using a tokenizer from the mylib.h file and memory for reading 
  * in as input is allocated once this function is executed and deallocated 
  * once this function finishes its execution. 
  * 
@@ -70,113 +504,346 @@ static void print_info(int freq, char *word) {
  */
 
 int main(int argc, char* argv[]) {
-    const char *optstring = "c:df:orh";
+    const char *optstring = "a:bc:de:f:ij:k:l:m:nop:rs:tu:x:zh";
+    const struct option longopts[] = {
+        { "sorted", no_argument, NULL, 'i' },
+        { "top", required_argument, NULL, 'k' },
+        { "stats", required_argument, NULL, 'm' },
+        { "serve", required_argument, NULL, 'p' },
+        { "spill", required_argument, NULL, 'x' },
+        { "no-freeze", no_argument, NULL, 'z' },
+        { NULL, 0, NULL, 0 }
+    };
     FILE *infile; 
     FILE *outfile;
     char option;
-    char word[WORD_SIZE];
+    char *word;
+    input source;
     char *searchFile = NULL;
     char *outputFile = NULL;
+    char *loadFile = NULL;
+    char *saveFile = NULL;
+    char *updateFile = NULL;
+    char *serveFile = NULL;
+    char *prefix = NULL;
+    char *tmpFile;
     int output_to_dot = 0;
-    int enable_rbt = 0;
+    tree_t type = BST;
     int print_depth = 0; 
-    clock_t fillStart, fillEnd;
-    clock_t searchStart, searchEnd;
+    int threads = 1;
+    int bulk = 0;
+    int sorted = 0;
+    int top = 0;
+    int distance = 0;
+    suggest index = NULL;
+    char *suggestions[SUGGESTIONS];
+    double suggestStart;
+    double indexTime = 0.0;
+    double suggestTime = 0.0;
+    int i, n, len;
+    int caching = 1;
+    int freezing = 1;
+    size_t budget = 0;
+    spill runs = NULL;
+    int statsFormat = -1;
+    struct stats startStats, fillStats, checkStats;
+    struct lookup_cache *cache = NULL;
+    double fillTime = 0.0;
+    double searchTime = 0.0;
+    double freezeTime = 0.0;
     int unknown_words = 0;
     tree t;
 
-    while((option = getopt(argc, argv, optstring)) != EOF) {
+    while((option = getopt_long(argc, argv, optstring, longopts, NULL)) != EOF) {
         switch (option) {
+            case 'a':
+                prefix = optarg;
+                break;
+            case 'b':
+                bulk = 1;
+                break;
             case 'c':
                 searchFile = optarg;
                 break;
             case 'd':
                 print_depth = 1;
                 break; 
+            case 'e':
+                distance = atoi(optarg);
+                if (distance < 1 || distance > 2) {
+                    fprintf(stderr, "Invalid edit distance '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
             case 'f':
                 outputFile = optarg;
                 break;
+            case 'i':
+                sorted = 1;
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                if (threads < 1) {
+                    fprintf(stderr, "Invalid number of threads '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'k':
+                top = atoi(optarg);
+                if (top < 1) {
+                    fprintf(stderr, "Invalid number of words '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'l':
+                loadFile = optarg;
+                break;
+            case 'm':
+                if (strcmp(optarg, "text") == 0) {
+                    statsFormat = 0;
+                } else if (strcmp(optarg, "json") == 0) {
+                    statsFormat = 1;
+                } else {
+                    fprintf(stderr, "Invalid statistics format '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'n':
+                caching = 0;
+                break;
             case 'o':
                 output_to_dot = 1;
                 break;
+            case 'p':
+                serveFile = optarg;
+                break;
             case 'r':
-                enable_rbt = 1;
+                type = RBT;
+                break;
+            case 's':
+                saveFile = optarg;
+                break;
+            case 't':
+                type = HASH;
+                break;
+            case 'u':
+                updateFile = optarg;
+                break;
+            case 'x':
+                if (atoi(optarg) < 1) {
+                    fprintf(stderr, "Invalid memory budget '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                budget = (size_t)atoi(optarg) << 20;
+                break;
+            case 'z':
+                freezing = 0;
                 break;
             case 'h':
-                fprintf(stderr, "Usage: %s [OPTION]... <STDIN>\n", argv[0]);
-                fprintf(stderr, "\n");
-                fprintf(stderr, "Perform various operations using a binary tree. By default, words\nare read from stdin and added to the tree, before being printed out\nalongside their frequencies to stdout.\n\n");
-                fprintf(stderr, "-c FILENAME\tCheck the spelling of words in FILENAME using words\n\t\tread from stdin as the dictionary. Print timing\n\t\tinfo & unknown words to stderr (ignore -d & -o)\n");
-                fprintf(stderr, "-d\t\tOnly print the tree depth (ignore -o)\n");
-                fprintf(stderr, "-f FILENAME\tWrite DOT output to FILENAME (if -o given)\n");
-                fprintf(stderr, "-o\t\tOutput the tree in DOT form to file 'tree-view.dot'\n");
-                fprintf(stderr, "-r\t\tMake the tree an RBT (the default is a BST)\n");
-                fprintf(stderr, "\n");
-                fprintf(stderr, "-h\t\tPrint this message\n");
+                print_usage(argv[0]);
                 return EXIT_FAILURE;
                 break;
             default:
-                fprintf(stderr, "Usage: %s [OPTION]... <STDIN>\n", argv[0]);
-                fprintf(stderr, "\n");
-                fprintf(stderr, "Perform various operations using a binary tree. By default, words\nare read from stdin and added to the tree, before being printed out\nalongside their frequencies to stdout.\n\n");
-                fprintf(stderr, "-c FILENAME\tCheck the spelling of words in FILENAME using words\n\t\tread from stdin as the dictionary. Print timing\n\t\tinfo & unknown words to stderr (ignore -d & -o)\n");
-                fprintf(stderr, "-d\t\tOnly print the tree depth (ignore -o)\n");
-                fprintf(stderr, "-f FILENAME\tWrite DOT output to FILENAME (if -o given)\n");
-                fprintf(stderr, "-o\t\tOutput the tree in DOT form to file 'tree-view.dot'\n");
-                fprintf(stderr, "-r\t\tMake the tree an RBT (the default is a BST)\n");
-                fprintf(stderr, "\n");
-                fprintf(stderr, "-h\t\tPrint this message\n");
+                print_usage(argv[0]);
                 return EXIT_FAILURE;
         } 
         
     }
+
+#ifndef STATS
+    if (statsFormat >= 0) {
+        fprintf(stderr, "Statistics need a build with -DSTATS\n");
+        statsFormat = -1;
+    }
+#endif
+    if (budget > 0) {
+        /* Only the sorted listing can be made from the runs. */
+        searchFile = outputFile = loadFile = saveFile = updateFile = NULL;
+        serveFile = prefix = NULL;
+        print_depth = output_to_dot = bulk = top = 0;
+        threads = 1;
+        runs = spill_new();
+    }
+    startStats = stats;
         
-    if (enable_rbt == 1) {
-        t = tree_new(enable_rbt);
+    if (loadFile != NULL) {
+        fillTime = wall_time();
+        t = tree_load(loadFile);
+        fillTime = wall_time() - fillTime;
+        if (t == NULL) {
+            fprintf(stderr, "Can't load snapshot %s\n", loadFile);
+            return EXIT_FAILURE;
+        }
     } else {
-        t = tree_new(enable_rbt);
+        if (NULL == (source = input_open(argv + optind, argc - optind, WORD_SIZE))) {
+            return EXIT_FAILURE;
+        }
+        fillTime = wall_time();
+        if (bulk) {
+            t = bulk_fill(type, source);
+        } else if (threads > 1) {
+            t = parallel_fill(type, threads, source);
+        } else {
+            t = tree_new(type);
+            while (input_next(source, &word) != EOF) {
+                tree_insert(t, word);
+                /* An insert can at most double tree_memory(t), so spilling
+                   at half the budget keeps the tree within it. */
+                if (runs != NULL && tree_memory(t) > budget / 2) {
+                    if (spill_tree(runs, t) == EOF) {
+                        fprintf(stderr, "Can't write temporary file\n");
+                        return EXIT_FAILURE;
+                    }
+                    tree_free(t);
+                    t = tree_new(type);
+                }
+            }
+        }
+        fillTime = wall_time() - fillTime;
+        if (input_close(source) == EOF) {
+            return EXIT_FAILURE;
+        }
     }
 
-    if (searchFile != NULL) {
-        fillStart = clock();
+    if (updateFile != NULL) {
+        if (NULL == (infile = fopen(updateFile, "r"))) {
+            fprintf(stderr, "Can't find file %s\n", updateFile);
+            return EXIT_FAILURE;
+        }
+        if (apply_updates(t, infile, updateFile) != 0) {
+            return EXIT_FAILURE;
+        }
+        fclose(infile);
     }
-    
-    while (getword(word, sizeof word, stdin) != EOF) {
-        if (enable_rbt == 1) {
-            t = rbt_insert(t, word);
-        } else {
-            t = tree_insert(t, word);
+    fillStats = stats;
+    checkStats = stats;
+
+    if (saveFile != NULL) {
+        /* Written beside the old snapshot and renamed over it, so an
+           interrupted save leaves the old snapshot whole, and a tree loaded
+           from that same snapshot is never read while it is overwritten. */
+        tmpFile = emalloc(strlen(saveFile) + 5);
+        sprintf(tmpFile, "%s.tmp", saveFile);
+        if (NULL == (outfile = fopen(tmpFile, "wb")) || tree_save(t, outfile) != 0
+            || fclose(outfile) != 0 || rename(tmpFile, saveFile) != 0) {
+            fprintf(stderr, "Can't save snapshot %s\n", saveFile);
+            return EXIT_FAILURE;
         }
+        free(tmpFile);
     }
 
-    if (searchFile != NULL) {
-        fillEnd = clock();
+    if (serveFile != NULL) {
+        fprintf(stderr, "Fill time     : %f\n", fillTime);
+        fprintf(stderr, "Serving on %s\n", serveFile);
+        if (server_run(t, serveFile) != 0) {
+            fprintf(stderr, "Can't serve on %s\n", serveFile);
+            return EXIT_FAILURE;
+        }
+        t = tree_free(t);
+        return EXIT_SUCCESS;
     }
 
-    if (searchFile == NULL && print_depth == 0 && output_to_dot == 0 && outputFile == NULL) {
-        tree_preorder(t, print_info);
+    if (searchFile == NULL && print_depth == 0 && output_to_dot == 0 && outputFile == NULL
+        && saveFile == NULL) {
+        listing = writer_new(stdout, LISTING_SIZE);
+        if (prefix != NULL && top > 0) {
+            tree_complete(t, prefix, top, print_info);
+        } else if (prefix != NULL) {
+            tree_prefix(t, prefix, print_info);
+        } else if (top > 0) {
+            tree_top(t, top, print_info);
+        } else if (runs != NULL && spill_runs(runs) > 0) {
+            if (spill_tree(runs, t) == EOF) {
+                fprintf(stderr, "Can't write temporary file\n");
+                return EXIT_FAILURE;
+            }
+            tree_free(t);
+            t = tree_new(type);
+            if (spill_merge(runs, print_info) == EOF) {
+                fprintf(stderr, "Can't read temporary file\n");
+                return EXIT_FAILURE;
+            }
+        } else if (sorted || runs != NULL) {
+            tree_inorder(t, print_info);
+        } else {
+            tree_preorder(t, print_info);
+        }
+        listing = writer_free(listing);
+        if (runs != NULL) {
+            fprintf(stderr, "Spilled runs  : %d\n", spill_runs(runs));
+            runs = spill_free(runs);
+        }
     }
     
     fflush(stdin);
 
     if (searchFile != NULL) {
-        if (NULL == (infile = fopen(searchFile, "r"))) {
-            fprintf(stderr, "Can't find file %s\n", optarg); 
+        if (NULL == (source = input_open(&searchFile, 1, WORD_SIZE))) {
             return EXIT_FAILURE;
         } else {
-            searchStart = clock();
-            while (getword(word, sizeof word, infile) != EOF) {
-                if (tree_search(t, word) == 0) {
-                    fprintf(stdout, "%s\n", word);
-                    unknown_words++;
+            if (distance > 0) {
+                suggestStart = wall_time();
+                index = suggest_new(t, distance);
+                indexTime = wall_time() - suggestStart;
+            }
+            if (caching) {
+                cache = cache_new();
+            }
+            if (freezing) {
+                freezeTime = wall_time();
+                tree_freeze(t);
+                freezeTime = wall_time() - freezeTime;
+            }
+            if (threads > 1 && index == NULL) {
+                searchTime = wall_time();
+                unknown_words = parallel_check(t, threads, source, cache);
+                searchTime = wall_time() - searchTime;
+            } else {
+                searchTime = wall_time();
+                while ((len = input_next(source, &word)) != EOF) {
+                    if (cache_search(cache, t, word, len) == 0) {
+                        unknown_words++;
+                        if (index == NULL) {
+                            fprintf(stdout, "%s\n", word);
+                            continue;
+                        }
+                        suggestStart = wall_time();
+                        n = suggest_word(index, word, suggestions, SUGGESTIONS);
+                        suggestTime += wall_time() - suggestStart;
+                        fprintf(stdout, "%s%s", word, n > 0 ? ":" : "");
+                        for (i = 0; i < n; i++) {
+                            fprintf(stdout, " %s", suggestions[i]);
+                        }
+                        fprintf(stdout, "\n");
+                    }
                 }
+                searchTime = wall_time() - searchTime;
+            }
+            if (input_close(source) == EOF) {
+                return EXIT_FAILURE;
             }
-            searchEnd = clock();
-            fclose(infile);
 
-            fprintf(stderr, "Fill time     : %f\n", (fillEnd - fillStart) / (double)CLOCKS_PER_SEC);
-            fprintf(stderr, "Search time   : %f\n", (searchEnd - searchStart) / (double)CLOCKS_PER_SEC);
+            checkStats = stats;
+            fprintf(stderr, "Fill time     : %f\n", fillTime);
+            fprintf(stderr, "Search time   : %f\n", searchTime);
+            if (freezing) {
+                fprintf(stderr, "Freeze time   : %f\n", freezeTime);
+            }
+            if (cache != NULL) {
+                fprintf(stderr, "Cache hits    : %ld of %ld (%.1f%%)\n", cache->hits,
+                        cache->hits + cache->misses,
+                        100.0 * cache->hits / (cache->hits + cache->misses > 0
+                                               ? cache->hits + cache->misses : 1));
+                cache_free(cache);
+            }
             fprintf(stderr, "Unknown words = %d\n", unknown_words);
+            if (index != NULL) {
+                fprintf(stderr, "Index time    : %f\n", indexTime);
+                fprintf(stderr, "Suggest time  : %f\n", suggestTime);
+                fprintf(stderr, "Suggest rate  : %.0f words/sec\n",
+                        suggestTime > 0.0 ? unknown_words / suggestTime : 0.0);
+                index = suggest_free(index);
+            }
         }
     }
    
@@ -188,19 +855,32 @@ int main(int argc, char* argv[]) {
     }
 
     if (searchFile == NULL) {
-        if (outputFile != NULL) {
-            outfile = fopen(outputFile, "w");
-            tree_output_dot(t, outfile);
-            fclose(outfile);
+        if (outputFile != NULL || output_to_dot == 1) {
+            int written;
+            if (outputFile == NULL) {
+                outputFile = "tree-view.dot";
+            }
+            if (NULL == (outfile = fopen(outputFile, "w"))) {
+                fprintf(stderr, "Can't create file %s\n", outputFile);
+                return EXIT_FAILURE;
+            }
+            written = tree_output_dot(t, outfile);
+            if (fclose(outfile) == EOF || written == EOF) {
+                fprintf(stderr, "Can't write file %s\n", outputFile);
+                return EXIT_FAILURE;
+            }
             fprintf(stdout, "Successfully created '%s'\n", outputFile);
-        } else if (output_to_dot == 1) {
-            outfile = fopen("tree-view.dot", "w");
-            tree_output_dot(t, outfile);
-            fclose(outfile);
-            fprintf(stdout, "Successfully created 'tree-view.dot'\n");
         }
     }
 
+    if (statsFormat >= 0) {
+        stats_print(stderr, "fill", &startStats, &fillStats, statsFormat);
+        if (searchFile != NULL) {
+            stats_print(stderr, "check", &fillStats, &checkStats, statsFormat);
+        }
+        stats_print(stderr, "total", &startStats, &stats, statsFormat);
+    }
+
     t = tree_free(t);
 
     return EXIT_SUCCESS;
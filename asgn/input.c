@@ -0,0 +1,506 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "input.h"
+#include "mylib.h"
+
+/**
+ * INPUT_CHUNK is the size of each buffer in the ring, and INPUT_QUEUE how
+ * many buffers there are, so the reader can get up to INPUT_QUEUE - 1
+ * chunks ahead of the one being split into words. INPUT_GZ_BUFFER is the
+ * size of zlib's own buffer for each file. Link with -lz.
+ */
+#define INPUT_CHUNK (1 << 20)
+#define INPUT_QUEUE 4
+#define INPUT_GZ_BUFFER (1 << 17)
+
+/**
+ * The paths to read are worked out when the input is opened, with NULL
+ * standing for stdin. A plain file, and stdin when it is redirected from
+ * one, is mapped by a tokenizer of its own, see tokenizer_open(), as it is
+ * the fastest way to read it. Only compressed files and anything else
+ * which can't be mapped, such as a pipe, are piped through the ring by the
+ * reader thread, and the ring is only made if there are some. The reader
+ * ends each file with an empty chunk.
+ *
+ * The ring holds count full chunks starting at head, the first of which
+ * is the one tk is splitting into words while piping is set. Otherwise tk
+ * is reading file, if it isn't NULL. next is the path read after that. A
+ * chunk only ever ends between words, or at the end of a file, so each is
+ * split into words on its own. The reader sets done once it has nothing
+ * more to add, and failed is set if a file couldn't be read.
+ */
+struct input_rec {
+    char **paths;
+    char *piped;
+    int n_paths;
+    int paths_size;
+    int n_piped;
+    int next;
+    int piping;
+    FILE *file;
+    char *chunks[INPUT_QUEUE];
+    size_t lens[INPUT_QUEUE];
+    int head;
+    int count;
+    int done;
+    int failed;
+    int stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;
+    pthread_cond_t emptied;
+    pthread_t reader;
+    tokenizer tk;
+    int limit;
+};
+
+static int path_cmp(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/**
+ * Returns 1 if the file at path, or stdin if path is NULL, has to be piped
+ * through the ring, because it is gzip-compressed or isn't a regular file,
+ * or 0 if it can be mapped. The magic number of stdin is read from where
+ * it is up to without moving on, so nothing is lost.
+ */
+static int input_needs_pipe(const char *path) {
+    unsigned char magic[2];
+    struct stat st;
+    off_t at;
+    int fd = (NULL == path) ? STDIN_FILENO : open(path, O_RDONLY);
+    int piped = 1;
+    if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+        && (at = lseek(fd, 0, SEEK_CUR)) >= 0) {
+        piped = (pread(fd, magic, 2, at) == 2 && 0x1f == magic[0] && 0x8b == magic[1]);
+    }
+    if (NULL != path && fd >= 0) {
+        close(fd);
+    }
+    return piped;
+}
+
+static void input_add_path(input in, char *path) {
+    if (in->n_paths == in->paths_size) {
+        in->paths_size *= 2;
+        in->paths = erealloc(in->paths, in->paths_size * sizeof in->paths[0]);
+        in->piped = erealloc(in->piped, in->paths_size * sizeof in->piped[0]);
+    }
+    in->piped[in->n_paths] = input_needs_pipe(path);
+    in->n_piped += in->piped[in->n_paths];
+    in->paths[in->n_paths++] = path;
+}
+
+/**
+ * Adds the file at path to the files to read, or if it is a directory
+ * every file under it, in order of name.
+ * Returns 0, or EOF if path or something under it can't be found or read.
+ */
+static int input_add(input in, const char *path) {
+    struct stat st;
+    struct dirent *entry;
+    DIR *dir;
+    char **names;
+    int n = 0, size = 16, i, result = 0;
+    size_t len = strlen(path);
+
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, "Can't find file %s\n", path);
+        return EOF;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        input_add_path(in, strcpy(emalloc(len + 1), path));
+        return 0;
+    }
+    if (NULL == (dir = opendir(path))) {
+        fprintf(stderr, "Can't read directory %s\n", path);
+        return EOF;
+    }
+    names = emalloc(size * sizeof names[0]);
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (n == size) {
+            size *= 2;
+            names = erealloc(names, size * sizeof names[0]);
+        }
+        names[n] = emalloc(len + strlen(entry->d_name) + 2);
+        sprintf(names[n++], "%s%s%s", path,
+                (len > 0 && path[len - 1] == '/') ? "" : "/", entry->d_name);
+    }
+    closedir(dir);
+    qsort(names, n, sizeof names[0], path_cmp);
+    for (i = 0; i < n; i++) {
+        if (result == 0 && input_add(in, names[i]) == EOF) {
+            result = EOF;
+        }
+        free(names[i]);
+    }
+    free(names);
+    return result;
+}
+
+/**
+ * Waits for a buffer of the ring to be free and returns its index, or -1
+ * if the input is being closed.
+ */
+static int input_slot(input in) {
+    int slot;
+    pthread_mutex_lock(&in->lock);
+    while (in->count == INPUT_QUEUE && !in->stopping) {
+        pthread_cond_wait(&in->emptied, &in->lock);
+    }
+    slot = in->stopping ? -1 : (in->head + in->count) % INPUT_QUEUE;
+    pthread_mutex_unlock(&in->lock);
+    return slot;
+}
+
+static void input_publish(input in, int slot, size_t len) {
+    pthread_mutex_lock(&in->lock);
+    in->lens[slot] = len;
+    in->count++;
+    pthread_cond_signal(&in->filled);
+    pthread_mutex_unlock(&in->lock);
+}
+
+/**
+ * Reads one file into the ring a chunk at a time, followed by an empty
+ * chunk. Each chunk is cut after the last character of it which can't be
+ * part of a word, as chunk_end() in asgn2 does, and the rest is carried
+ * over to the start of the next. Only a chunk with no such character in
+ * it is cut in the middle of a word. Returns 0, 1 if the input is being
+ * closed, or EOF if the file couldn't be read.
+ */
+static int input_file(input in, char *path, char *carry) {
+    gzFile g = (NULL == path) ? gzdopen(dup(STDIN_FILENO), "rb") : gzopen(path, "rb");
+    size_t len, cut, carried = 0;
+    int slot, n = 0, eof = 0;
+    char *buf;
+
+    if (NULL == g) {
+        return EOF;
+    }
+    gzbuffer(g, INPUT_GZ_BUFFER);
+    while (!eof) {
+        if ((slot = input_slot(in)) < 0) {
+            gzclose(g);
+            return 1;
+        }
+        buf = in->chunks[slot];
+        memcpy(buf, carry, carried);
+        len = carried;
+        while (len < INPUT_CHUNK && (n = gzread(g, buf + len, INPUT_CHUNK - len)) > 0) {
+            len += n;
+        }
+        if (n < 0) {
+            gzclose(g);
+            return EOF;
+        }
+        eof = (len < INPUT_CHUNK);
+        cut = len;
+        if (!eof) {
+            while (cut > 0 && (isalnum((unsigned char)buf[cut - 1]) || '\'' == buf[cut - 1])) {
+                cut--;
+            }
+            if (cut == 0) {
+                cut = len;
+            }
+        }
+        carried = len - cut;
+        memcpy(carry, buf + cut, carried);
+        if (cut > 0) {
+            input_publish(in, slot, cut);
+        }
+    }
+    if (gzclose(g) != Z_OK) {
+        return EOF;
+    }
+    if ((slot = input_slot(in)) < 0) {
+        return 1;
+    }
+    input_publish(in, slot, 0);
+    return 0;
+}
+
+static void *input_reader(void *arg) {
+    input in = arg;
+    char *carry = emalloc(INPUT_CHUNK);
+    int i, result = 0;
+    for (i = 0; i < in->n_paths && result == 0; i++) {
+        if (!in->piped[i]) {
+            continue;
+        }
+        if ((result = input_file(in, in->paths[i], carry)) == EOF) {
+            if (NULL == in->paths[i]) {
+                fprintf(stderr, "Can't read stdin\n");
+            } else {
+                fprintf(stderr, "Can't read file %s\n", in->paths[i]);
+            }
+        }
+    }
+    free(carry);
+    pthread_mutex_lock(&in->lock);
+    in->done = 1;
+    if (result == EOF) {
+        in->failed = 1;
+    }
+    pthread_cond_signal(&in->filled);
+    pthread_mutex_unlock(&in->lock);
+    return NULL;
+}
+
+/**
+ * Opens the files at paths for reading words no longer than limit - 1
+ * characters, as a tokenizer would, and starts reading them. A path which
+ * is a directory stands for every file under it, and the path "-" or no
+ * paths at all for stdin.
+ * Returns the input, or NULL if a path can't be found.
+ */
+input input_open(char **paths, int n_paths, int limit) {
+    input in = emalloc(sizeof *in);
+    int i;
+
+    in->paths_size = 16;
+    in->paths = emalloc(in->paths_size * sizeof in->paths[0]);
+    in->piped = emalloc(in->paths_size * sizeof in->piped[0]);
+    in->n_paths = 0;
+    in->n_piped = 0;
+    if (n_paths == 0) {
+        input_add_path(in, NULL);
+    }
+    for (i = 0; i < n_paths; i++) {
+        if (strcmp(paths[i], "-") == 0) {
+            input_add_path(in, NULL);
+        } else if (input_add(in, paths[i]) == EOF) {
+            while (in->n_paths > 0) {
+                free(in->paths[--in->n_paths]);
+            }
+            free(in->paths);
+            free(in->piped);
+            free(in);
+            return NULL;
+        }
+    }
+
+    for (i = 0; i < INPUT_QUEUE; i++) {
+        in->chunks[i] = (in->n_piped > 0) ? emalloc(INPUT_CHUNK) : NULL;
+    }
+    in->next = 0;
+    in->piping = 0;
+    in->file = NULL;
+    in->head = 0;
+    in->count = 0;
+    in->done = 0;
+    in->failed = 0;
+    in->stopping = 0;
+    in->tk = NULL;
+    in->limit = limit;
+    pthread_mutex_init(&in->lock, NULL);
+    pthread_cond_init(&in->filled, NULL);
+    pthread_cond_init(&in->emptied, NULL);
+    if (in->n_piped > 0 && pthread_create(&in->reader, NULL, input_reader, in) != 0) {
+        fprintf(stderr, "Failed to create thread\n");
+        exit(EXIT_FAILURE);
+    }
+    return in;
+}
+
+/**
+ * Waits for the next chunk of the ring to be full.
+ * Returns 1, or 0 once every chunk has been read.
+ */
+static int input_take(input in) {
+    int ready;
+    pthread_mutex_lock(&in->lock);
+    while (in->count == 0 && !in->done) {
+        pthread_cond_wait(&in->filled, &in->lock);
+    }
+    ready = (in->count > 0);
+    pthread_mutex_unlock(&in->lock);
+    return ready;
+}
+
+/**
+ * Hands the chunk at the head of the ring back to the reader.
+ */
+static void input_release(input in) {
+    pthread_mutex_lock(&in->lock);
+    in->head = (in->head + 1) % INPUT_QUEUE;
+    in->count--;
+    pthread_cond_signal(&in->emptied);
+    pthread_mutex_unlock(&in->lock);
+}
+
+static void input_file_error(input in, const char *path) {
+    if (NULL == path) {
+        fprintf(stderr, "Can't read stdin\n");
+    } else {
+        fprintf(stderr, "Can't read file %s\n", path);
+    }
+    pthread_mutex_lock(&in->lock);
+    in->failed = 1;
+    pthread_mutex_unlock(&in->lock);
+}
+
+/**
+ * Moves on to the next piece of the input: the next chunk of the file
+ * being piped, or else the next file, which if it is plain is opened as
+ * file, or is stdin itself. Returns 1, or 0 once every file has been read
+ * or one couldn't be.
+ */
+static int input_advance(input in) {
+    for (;;) {
+        if (in->piping) {
+            if (!input_take(in)) {
+                return 0;
+            }
+            if (in->lens[in->head] > 0) {
+                return 1;
+            }
+            input_release(in);
+            in->piping = 0;
+        }
+        if (in->next == in->n_paths) {
+            return 0;
+        }
+        if (in->piped[in->next]) {
+            in->piping = 1;
+            in->next++;
+            continue;
+        }
+        in->file = (NULL == in->paths[in->next]) ? stdin : fopen(in->paths[in->next], "rb");
+        if (NULL == in->file) {
+            input_file_error(in, in->paths[in->next]);
+            return 0;
+        }
+        in->next++;
+        return 1;
+    }
+}
+
+/**
+ * Finishes with the piece of the input input_advance() moved on to. A
+ * tokenizer maps stdin without reading it, so it is moved to its end, as
+ * it would be once piped.
+ */
+static void input_finish(input in) {
+    if (in->piping) {
+        input_release(in);
+    } else {
+        if (ferror(in->file)) {
+            input_file_error(in, in->paths[in->next - 1]);
+        }
+        if (stdin == in->file) {
+            fseek(stdin, 0, SEEK_END);
+        } else {
+            fclose(in->file);
+        }
+        in->file = NULL;
+    }
+}
+
+/**
+ * Sets *word to the next word of the input, like tokenizer_next().
+ * Returns the length of the word or EOF when there are no more words.
+ */
+int input_next(input in, char **word) {
+    int len;
+    for (;;) {
+        if (in->tk != NULL) {
+            if ((len = tokenizer_next(in->tk, word)) != EOF) {
+                return len;
+            }
+            in->tk = tokenizer_free(in->tk);
+            input_finish(in);
+        }
+        if (!input_advance(in)) {
+            return EOF;
+        }
+        if (in->piping) {
+            in->tk = tokenizer_new(in->chunks[in->head], in->lens[in->head], in->limit);
+        } else {
+            in->tk = tokenizer_open(in->file, in->limit);
+        }
+    }
+}
+
+/**
+ * Reads the rest of the input into one buffer, with a newline after each
+ * chunk so that no word runs from one file into the next.
+ * Returns the buffer, which the caller must free, with its length in *len.
+ */
+char *input_read(input in, size_t *len) {
+    size_t size = 1 << 16, n;
+    char *text = emalloc(size);
+    *len = 0;
+    if (in->tk != NULL) {
+        in->tk = tokenizer_free(in->tk);
+        input_finish(in);
+    }
+    while (input_advance(in)) {
+        if (in->piping) {
+            while (*len + in->lens[in->head] + 1 > size) {
+                size *= 2;
+                text = erealloc(text, size);
+            }
+            memcpy(text + *len, in->chunks[in->head], in->lens[in->head]);
+            *len += in->lens[in->head];
+        } else {
+            do {
+                if (*len + 1 == size) {
+                    size *= 2;
+                    text = erealloc(text, size);
+                }
+                *len += (n = fread(text + *len, 1, size - *len - 1, in->file));
+            } while (n > 0);
+        }
+        text[(*len)++] = '\n';
+        input_finish(in);
+    }
+    return text;
+}
+
+/**
+ * Stops reading the input, if it hasn't all been read, and frees it.
+ * Returns 0, or EOF if a file couldn't be read.
+ */
+int input_close(input in) {
+    int i, failed;
+    if (in->n_piped > 0) {
+        pthread_mutex_lock(&in->lock);
+        in->stopping = 1;
+        pthread_cond_signal(&in->emptied);
+        pthread_mutex_unlock(&in->lock);
+        pthread_join(in->reader, NULL);
+    }
+    failed = in->failed;
+
+    tokenizer_free(in->tk);
+    if (NULL != in->file && stdin != in->file) {
+        fclose(in->file);
+    }
+    for (i = 0; i < INPUT_QUEUE; i++) {
+        free(in->chunks[i]);
+    }
+    for (i = 0; i < in->n_paths; i++) {
+        free(in->paths[i]);
+    }
+    pthread_cond_destroy(&in->emptied);
+    pthread_cond_destroy(&in->filled);
+    pthread_mutex_destroy(&in->lock);
+    free(in->paths);
+    free(in->piped);
+    free(in);
+    return failed ? EOF : 0;
+}
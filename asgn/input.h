@@ -0,0 +1,29 @@
+/**
+ * @file input.h
+ *
+ * Reading the words of any number of files, given by name, by directory or
+ * as stdin, any of which can be gzip-compressed. The files of a directory
+ * and its subdirectories are read in order of name, and each file ends a
+ * word, so the words are those of the files read one after another.
+ *
+ * A plain file is mapped into memory a piece at a time by a tokenizer. A
+ * thread of its own reads and decompresses stdin and compressed files into
+ * a small ring of buffers, while the caller splits them into words and
+ * uses them, so waiting for the disk and decompressing overlap with the
+ * caller's work. The reader waits whenever every buffer is full, so the
+ * memory used stays the same however much there is to read.
+ */
+
+#ifndef INPUT_H_
+#define INPUT_H_
+
+#include <stddef.h>
+
+typedef struct input_rec *input;
+
+extern input input_open(char **paths, int n_paths, int limit);
+extern int input_next(input in, char **word);
+extern char *input_read(input in, size_t *len);
+extern int input_close(input in);
+
+#endif
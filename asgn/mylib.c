@@ -1,11 +1,117 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "mylib.h"
 #include <assert.h>
 #include <ctype.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TOKENIZER_SIMD
+#include <immintrin.h>
+#endif
+
+/**
+ * Every pointer handed out by arena_alloc() is aligned to this many bytes,
+ * which is enough for any of the structs stored in an arena.
+ */
+#define ARENA_ALIGN 8
+
+/**
+ * An arena is a list of large blocks which are handed out by bumping a
+ * pointer. Nothing is freed individually; arena_free() releases every
+ * block at once.
+ */
+struct arena_block {
+    struct arena_block *next;
+    size_t size;
+};
+
+struct arena_rec {
+    struct arena_block *head;
+    char *next;
+    char *end;
+    size_t block_size;
+};
+
+/**
+ * A tokenizer maps a file into memory this many bytes at a time, unmapping
+ * each piece once it has been read, so however big the file is no more of
+ * it than this is ever resident. It is a multiple of any page size. When a
+ * tokenizer can't map its input it reads it in blocks of
+ * TOKENIZER_BLOCK_SIZE bytes instead.
+ */
+#define TOKENIZER_MAP_SIZE (1 << 22)
+#define TOKENIZER_BLOCK_SIZE (1 << 20)
+
+/**
+ * A tokenizer splits text into the same words getword() would read from it,
+ * but scans a buffer directly instead of calling getc() for every
+ * character. The text is either a mapping of a piece of a file, starting
+ * map_off bytes into it, a block of a stream, either of which is replaced
+ * by the next as it runs out, or a caller's buffer.
+ */
+struct tokenizer_rec {
+    unsigned char *text;
+    size_t len;
+    size_t pos;
+    FILE *stream;
+    unsigned char *block;
+    void *map;
+    size_t map_len;
+    off_t map_off;
+    off_t file_size;
+    char *word;
+    int limit;
+};
+
+/**
+ * A writer collects output in one large buffer which is written to its
+ * stream with fwrite() whenever it fills, so that writing a word or a
+ * number costs a memcpy() rather than a call to printf(). Numbers are
+ * formatted by hand. A failed write is remembered and reported by
+ * writer_flush().
+ */
+struct writer_rec {
+    FILE *stream;
+    char *buf;
+    size_t len;
+    size_t size;
+    int error;
+};
+
+/**
+ * word_char[c] is the lowercase version of c if getword() would keep c as
+ * part of a word, and 0 otherwise. It is filled in from isalnum() and
+ * tolower() so it agrees with getword() in the current locale.
+ */
+static unsigned char word_char[256];
+static int word_char_ready = 0;
+
+/**
+ * The tokenizer scans text with two kernels. skip_fn() returns the index of
+ * the first word character in p[0..n), or n if there is none. span_fn()
+ * copies the lowercased run of word characters at the start of p[0..n) to
+ * out and returns its length, stopping at the first other character, which
+ * includes apostrophes. Both start out as the scalar versions and are
+ * switched to SSE2 or AVX2 versions by word_char_init() when the CPU
+ * supports them and the locale classifies characters as plain ASCII.
+ */
+static size_t skip_scalar(const unsigned char *p, size_t n);
+static size_t span_scalar(const unsigned char *p, size_t n, char *out);
+static size_t (*skip_fn)(const unsigned char *p, size_t n) = skip_scalar;
+static size_t (*span_fn)(const unsigned char *p, size_t n, char *out) = span_scalar;
+
+struct stats stats;
 
 void *emalloc(size_t s){
     void *result = malloc(s);
+    STATS_ADD(STAT_ALLOCS, 1);
+    STATS_ADD(STAT_ALLOC_BYTES, s);
     if(NULL == result){
         fprintf(stderr, "Memory allocation failed\n");
         exit(EXIT_FAILURE);
@@ -15,6 +121,8 @@ void *emalloc(size_t s){
 
 void *erealloc(void *p, size_t s){
     void *result = realloc(p, s);
+    STATS_ADD(STAT_REALLOCS, 1);
+    STATS_ADD(STAT_REALLOC_BYTES, s);
     if(NULL == result){
         fprintf(stderr, "Memory reallocation failed\n");
         exit(EXIT_FAILURE);
@@ -44,5 +152,522 @@ int getword(char *s, int limit, FILE *stream){
         }
     }
     *w = '\0';
+    STATS_ADD(STAT_WORDS, 1);
     return w -s;
 }
+
+/**
+ * Prints the counts made between two snapshots of the stats, from and to,
+ * for the named phase of a run. Either as text, or as a line of JSON.
+ */
+void stats_print(FILE *out, const char *phase, struct stats *from,
+                 struct stats *to, int json){
+    static const char *names[STAT_COUNT] = {
+        "words", "allocs", "alloc_bytes", "reallocs", "realloc_bytes",
+        "inserts", "insert_compares", "searches", "search_compares",
+        "full_compares", "hash_probes", "rotations", "recolours"
+    };
+    int i;
+    if (json) {
+        fprintf(out, "{\"phase\":\"%s\"", phase);
+        for (i = 0; i < STAT_COUNT; i++) {
+            fprintf(out, ",\"%s\":%lu", names[i], to->count[i] - from->count[i]);
+        }
+        fprintf(out, "}\n");
+        return;
+    }
+    fprintf(out, "%s:\n", phase);
+    for (i = 0; i < STAT_COUNT; i++) {
+        fprintf(out, "  %-16s %lu\n", names[i], to->count[i] - from->count[i]);
+    }
+}
+
+arena arena_new(size_t block_size){
+    arena a = emalloc(sizeof *a);
+    a->head = NULL;
+    a->next = NULL;
+    a->end = NULL;
+    a->block_size = block_size;
+    return a;
+}
+
+static void arena_grow(arena a, size_t s){
+    size_t size = s > a->block_size ? s : a->block_size;
+    struct arena_block *b = emalloc(sizeof *b + size);
+    b->next = a->head;
+    b->size = size;
+    a->head = b;
+    a->next = (char *)(b + 1);
+    a->end = a->next + size;
+}
+
+void *arena_alloc(arena a, size_t s){
+    void *result;
+    size_t pad = (ARENA_ALIGN - (size_t)a->next % ARENA_ALIGN) % ARENA_ALIGN;
+    if (NULL == a->next || (size_t)(a->end - a->next) < pad + s) {
+        arena_grow(a, s);
+        pad = 0;
+    }
+    result = a->next + pad;
+    a->next += pad + s;
+    return result;
+}
+
+char *arena_strdup(arena a, const char *str){
+    size_t s = strlen(str) + 1;
+    char *result;
+    if (NULL == a->next || (size_t)(a->end - a->next) < s) {
+        arena_grow(a, s);
+    }
+    result = a->next;
+    a->next += s;
+    memcpy(result, str, s);
+    return result;
+}
+
+arena arena_free(arena a){
+    struct arena_block *b, *next;
+    if (NULL == a) {
+        return NULL;
+    }
+    for (b = a->head; b != NULL; b = next) {
+        next = b->next;
+        free(b);
+    }
+    free(a);
+    return NULL;
+}
+
+static size_t skip_scalar(const unsigned char *p, size_t n){
+    size_t i = 0;
+    while (i < n && 0 == word_char[p[i]]) {
+        i++;
+    }
+    return i;
+}
+
+static size_t span_scalar(const unsigned char *p, size_t n, char *out){
+    size_t i = 0;
+    unsigned char c;
+    while (i < n && 0 != (c = word_char[p[i]])) {
+        out[i++] = c;
+    }
+    return i;
+}
+
+#ifdef TOKENIZER_SIMD
+
+/**
+ * The vector kernels classify bytes with ASCII rules: a byte is a word
+ * character if it is a digit or a letter once 0x20 is ORed in, and ORing
+ * in 0x20 is also how it is lowercased, as digits already have that bit
+ * set. Bytes of 0x80 and up compare as negative, so are never matched.
+ */
+static __m128i alnum_sse2(__m128i x){
+    __m128i lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(x, _mm_set1_epi8('9' + 1)));
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                  _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+    return _mm_or_si128(digit, alpha);
+}
+
+static size_t skip_sse2(const unsigned char *p, size_t n){
+    size_t i = 0;
+    unsigned int bits;
+    while (i + 16 <= n) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(p + i));
+        bits = _mm_movemask_epi8(alnum_sse2(x));
+        if (bits) {
+            return i + __builtin_ctz(bits);
+        }
+        i += 16;
+    }
+    return i + skip_scalar(p + i, n - i);
+}
+
+static size_t span_sse2(const unsigned char *p, size_t n, char *out){
+    size_t i = 0;
+    unsigned int bits;
+    while (i + 16 <= n) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(p + i));
+        bits = ~_mm_movemask_epi8(alnum_sse2(x)) & 0xFFFF;
+        _mm_storeu_si128((__m128i *)(out + i), _mm_or_si128(x, _mm_set1_epi8(0x20)));
+        if (bits) {
+            return i + __builtin_ctz(bits);
+        }
+        i += 16;
+    }
+    return i + span_scalar(p + i, n - i, out + i);
+}
+
+/**
+ * Most words and the gaps between them are shorter than 16 bytes, so the
+ * AVX2 kernels look at the first 16 bytes with SSE2 and only move on to
+ * 32 byte steps for longer runs.
+ */
+__attribute__((target("avx2")))
+static __m256i alnum_avx2(__m256i x){
+    __m256i lower = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+    __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8('0' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), x));
+    __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+    return _mm256_or_si256(digit, alpha);
+}
+
+__attribute__((target("avx2")))
+static size_t skip_avx2(const unsigned char *p, size_t n){
+    size_t i = 0;
+    unsigned int bits;
+    if (n >= 16 && (i = skip_sse2(p, 16)) < 16) {
+        return i;
+    }
+    while (i + 32 <= n) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(p + i));
+        bits = _mm256_movemask_epi8(alnum_avx2(x));
+        if (bits) {
+            return i + __builtin_ctz(bits);
+        }
+        i += 32;
+    }
+    return i + skip_sse2(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t span_avx2(const unsigned char *p, size_t n, char *out){
+    size_t i = 0;
+    unsigned int bits;
+    if (n >= 16 && (i = span_sse2(p, 16, out)) < 16) {
+        return i;
+    }
+    while (i + 32 <= n) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(p + i));
+        bits = ~(unsigned int)_mm256_movemask_epi8(alnum_avx2(x));
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_or_si256(x, _mm256_set1_epi8(0x20)));
+        if (bits) {
+            return i + __builtin_ctz(bits);
+        }
+        i += 32;
+    }
+    return i + span_sse2(p + i, n - i, out + i);
+}
+
+/**
+ * Returns 1 if word_char[] matches the ASCII rules the vector kernels use.
+ */
+static int word_char_is_ascii(void){
+    int c;
+    for (c = 0; c < 256; c++) {
+        int alnum = (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z');
+        if (word_char[c] != (alnum ? (c | 0x20) : 0)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+#endif
+
+static void word_char_init(void){
+    int c;
+    if (word_char_ready) {
+        return;
+    }
+    for (c = 0; c < 256; c++) {
+        word_char[c] = isalnum(c) ? tolower(c) : 0;
+    }
+#ifdef TOKENIZER_SIMD
+    if (word_char_is_ascii()) {
+        skip_fn = skip_sse2;
+        span_fn = span_sse2;
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            skip_fn = skip_avx2;
+            span_fn = span_avx2;
+        }
+    }
+#endif
+    word_char_ready = 1;
+}
+
+static tokenizer tokenizer_alloc(int limit){
+    tokenizer tk = emalloc(sizeof *tk);
+    assert(limit > 1);
+    word_char_init();
+    tk->text = NULL;
+    tk->len = 0;
+    tk->pos = 0;
+    tk->stream = NULL;
+    tk->block = NULL;
+    tk->map = NULL;
+    tk->map_len = 0;
+    tk->map_off = 0;
+    tk->file_size = 0;
+    tk->word = emalloc(limit);
+    tk->limit = limit;
+    return tk;
+}
+
+static int tokenizer_fill(tokenizer tk);
+
+/**
+ * Maps the piece of the tokenizer's file holding offset in place of the
+ * one mapped before, and starts reading at offset. If it can't be mapped
+ * the rest of the file is read from the stream in blocks instead.
+ * Returns 1, or 0 if there is nothing left to read.
+ */
+static int tokenizer_map(tokenizer tk, off_t offset){
+    off_t start = offset - offset % TOKENIZER_MAP_SIZE;
+    size_t len = TOKENIZER_MAP_SIZE;
+    void *map;
+
+    if (offset >= tk->file_size) {
+        return 0;
+    }
+    if (tk->file_size - start < TOKENIZER_MAP_SIZE) {
+        len = tk->file_size - start;
+    }
+    map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fileno(tk->stream), start);
+    if (NULL != tk->map) {
+        munmap(tk->map, tk->map_len);
+    }
+    if (MAP_FAILED == map) {
+        tk->map = NULL;
+        tk->block = emalloc(TOKENIZER_BLOCK_SIZE);
+        tk->text = tk->block;
+        tk->len = tk->pos = 0;
+        return fseeko(tk->stream, offset, SEEK_SET) == 0 && tokenizer_fill(tk);
+    }
+    posix_madvise(map, len, POSIX_MADV_SEQUENTIAL);
+    tk->map = map;
+    tk->map_len = len;
+    tk->map_off = start;
+    tk->text = (unsigned char *)map + (offset - start);
+    tk->len = len - (offset - start);
+    tk->pos = 0;
+    return 1;
+}
+
+tokenizer tokenizer_open(FILE *stream, int limit){
+    tokenizer tk = tokenizer_alloc(limit);
+    struct stat st;
+    long offset = ftell(stream);
+
+    tk->stream = stream;
+    if (offset >= 0 && fstat(fileno(stream), &st) == 0 && S_ISREG(st.st_mode)
+        && st.st_size > offset) {
+        tk->file_size = st.st_size;
+        tokenizer_map(tk, offset);
+        return tk;
+    }
+    tk->block = emalloc(TOKENIZER_BLOCK_SIZE);
+    tk->text = tk->block;
+    return tk;
+}
+
+tokenizer tokenizer_new(char *text, size_t len, int limit){
+    tokenizer tk = tokenizer_alloc(limit);
+    tk->text = (unsigned char *)text;
+    tk->len = len;
+    return tk;
+}
+
+/**
+ * Makes every tokenizer use the named kernels, "scalar", "sse2" or "avx2",
+ * instead of the fastest ones the CPU supports, so that they can be
+ * checked against each other.
+ * Returns 0, or EOF if those kernels can't be used here.
+ */
+int tokenizer_kernels(const char *name){
+    word_char_init();
+    if (strcmp(name, "scalar") == 0) {
+        skip_fn = skip_scalar;
+        span_fn = span_scalar;
+        return 0;
+    }
+#ifdef TOKENIZER_SIMD
+    if (!word_char_is_ascii()) {
+        return EOF;
+    }
+    if (strcmp(name, "sse2") == 0) {
+        skip_fn = skip_sse2;
+        span_fn = span_sse2;
+        return 0;
+    }
+    __builtin_cpu_init();
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        skip_fn = skip_avx2;
+        span_fn = span_avx2;
+        return 0;
+    }
+#endif
+    return EOF;
+}
+
+/**
+ * Moves on to the next block of a streamed tokenizer's input.
+ * Returns 0 once there is nothing left to read.
+ */
+static int tokenizer_fill(tokenizer tk){
+    if (NULL != tk->map) {
+        return tokenizer_map(tk, tk->map_off + tk->map_len);
+    }
+    if (NULL == tk->stream) {
+        return 0;
+    }
+    tk->len = fread(tk->block, 1, TOKENIZER_BLOCK_SIZE, tk->stream);
+    tk->pos = 0;
+    return tk->len > 0;
+}
+
+/**
+ * Sets *word to the next word in the tokenizer's input. Words follow the
+ * same rules as getword(): letters and digits are lowercased, apostrophes
+ * are dropped, and a word longer than limit - 1 characters is split.
+ * The word is only valid until the next call.
+ * Returns the length of the word or EOF when there are no more words.
+ */
+int tokenizer_next(tokenizer tk, char **word){
+    char *w = tk->word;
+    char *end = tk->word + tk->limit - 1;
+    size_t n;
+
+    for (;;) {
+        if (tk->pos == tk->len && !tokenizer_fill(tk)) {
+            return EOF;
+        }
+        tk->pos += skip_fn(tk->text + tk->pos, tk->len - tk->pos);
+        if (tk->pos < tk->len) {
+            break;
+        }
+    }
+
+    while (w < end) {
+        if (tk->pos == tk->len && !tokenizer_fill(tk)) {
+            break;
+        }
+        n = tk->len - tk->pos;
+        if (n > (size_t)(end - w)) {
+            n = end - w;
+        }
+        n = span_fn(tk->text + tk->pos, n, w);
+        w += n;
+        tk->pos += n;
+        if (w == end || tk->pos == tk->len) {
+            continue;
+        }
+        if ('\'' != tk->text[tk->pos++]) {
+            break;
+        }
+    }
+    *w = '\0';
+    *word = tk->word;
+    STATS_ADD(STAT_WORDS, 1);
+    return w - tk->word;
+}
+
+tokenizer tokenizer_free(tokenizer tk){
+    if (NULL == tk) {
+        return NULL;
+    }
+    if (NULL != tk->map) {
+        munmap(tk->map, tk->map_len);
+    }
+    free(tk->block);
+    free(tk->word);
+    free(tk);
+    return NULL;
+}
+
+writer writer_new(FILE *stream, size_t size){
+    writer w = emalloc(sizeof *w);
+    w->stream = stream;
+    w->size = size < 64 ? 64 : size;
+    w->buf = emalloc(w->size);
+    w->len = 0;
+    w->error = 0;
+    return w;
+}
+
+static void writer_drain(writer w){
+    if (w->len > 0 && fwrite(w->buf, 1, w->len, w->stream) != w->len) {
+        w->error = 1;
+    }
+    w->len = 0;
+}
+
+void writer_str(writer w, const char *str){
+    size_t n = strlen(str);
+    if (w->size - w->len < n) {
+        writer_drain(w);
+        if (n > w->size) {
+            if (fwrite(str, 1, n, w->stream) != n) {
+                w->error = 1;
+            }
+            return;
+        }
+    }
+    memcpy(w->buf + w->len, str, n);
+    w->len += n;
+}
+
+void writer_char(writer w, int c){
+    if (w->len == w->size) {
+        writer_drain(w);
+    }
+    w->buf[w->len++] = c;
+}
+
+/**
+ * Writes n in decimal, followed by enough spaces to fill width characters,
+ * as printf("%-*ld", width, n) would.
+ */
+void writer_int(writer w, long n, int width){
+    char digits[24];
+    unsigned long u = n < 0 ? 0UL - (unsigned long)n : (unsigned long)n;
+    int len = 0;
+    do {
+        digits[sizeof digits - 1 - len++] = '0' + u % 10;
+        u /= 10;
+    } while (u > 0);
+    if (n < 0) {
+        digits[sizeof digits - 1 - len++] = '-';
+    }
+    if (w->size - w->len < (size_t)(len > width ? len : width)) {
+        writer_drain(w);
+    }
+    memcpy(w->buf + w->len, digits + sizeof digits - len, len);
+    w->len += len;
+    for (; len < width && w->len < w->size; len++) {
+        w->buf[w->len++] = ' ';
+    }
+    for (; len < width; len++) {
+        writer_char(w, ' ');
+    }
+}
+
+/**
+ * Writes out everything buffered so far.
+ * Returns 0, or EOF if any write has failed since the writer was made.
+ */
+int writer_flush(writer w){
+    writer_drain(w);
+    if (fflush(w->stream) == EOF) {
+        w->error = 1;
+    }
+    return w->error ? EOF : 0;
+}
+
+/**
+ * Flushes and frees a writer, leaving its stream open.
+ */
+writer writer_free(writer w){
+    if (NULL == w) {
+        return NULL;
+    }
+    writer_flush(w);
+    free(w->buf);
+    free(w);
+    return NULL;
+}
@@ -3,8 +3,57 @@
 
 #include <stddef.h>
 
+typedef struct arena_rec *arena;
+typedef struct tokenizer_rec *tokenizer;
+typedef struct writer_rec *writer;
+
+/*
+ * Counters of the work done on the hot paths, kept only when built with
+ * -DSTATS so that they cost nothing otherwise. They are plain globals, so
+ * counts made from several threads at once can be a little low.
+ */
+enum stats_e {
+    STAT_WORDS, STAT_ALLOCS, STAT_ALLOC_BYTES, STAT_REALLOCS,
+    STAT_REALLOC_BYTES, STAT_INSERTS, STAT_INSERT_COMPARES, STAT_SEARCHES,
+    STAT_SEARCH_COMPARES, STAT_FULL_COMPARES, STAT_HASH_PROBES,
+    STAT_ROTATIONS, STAT_RECOLOURS, STAT_COUNT
+};
+
+struct stats {
+    unsigned long count[STAT_COUNT];
+};
+
+extern struct stats stats;
+
+#ifdef STATS
+#define STATS_ADD(stat, n) (stats.count[stat] += (n))
+#else
+#define STATS_ADD(stat, n) ((void) 0)
+#endif
+
 extern void *emalloc(size_t);
 extern void *erealloc(void *, size_t);
 extern int getword(char *s, int limit, FILE *stream);
 
+extern void stats_print(FILE *out, const char *phase, struct stats *from,
+                        struct stats *to, int json);
+
+extern arena arena_new(size_t block_size);
+extern void *arena_alloc(arena a, size_t s);
+extern char *arena_strdup(arena a, const char *str);
+extern arena arena_free(arena a);
+
+extern tokenizer tokenizer_open(FILE *stream, int limit);
+extern tokenizer tokenizer_new(char *text, size_t len, int limit);
+extern int tokenizer_next(tokenizer tk, char **word);
+extern tokenizer tokenizer_free(tokenizer tk);
+extern int tokenizer_kernels(const char *name);
+
+extern writer writer_new(FILE *stream, size_t size);
+extern void writer_str(writer w, const char *str);
+extern void writer_char(writer w, int c);
+extern void writer_int(writer w, long n, int width);
+extern int writer_flush(writer w);
+extern writer writer_free(writer w);
+
 #endif
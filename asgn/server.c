@@ -0,0 +1,426 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "server.h"
+#include "mylib.h"
+
+/**
+ * SERVER_BUFFER is the size of the buffers each connection reads requests
+ * into and collects replies in, which also limits the length of a request.
+ * SERVER_BACKLOG is how many connections can wait to be accepted.
+ */
+#define SERVER_BUFFER (1 << 16)
+#define SERVER_BACKLOG 64
+
+/**
+ * The server keeps two copies of the tree so that lookups never wait for
+ * an update to finish. Readers use the copy current names, counting
+ * themselves in readers while they do. An update is made to the other
+ * copy, which nobody is reading, then current is switched to it, and once
+ * the last reader of the old copy has left the same update is made to
+ * that copy too. Like RCU, readers only touch the lock for long enough to
+ * count themselves in and out, once per batch, while writers take turns
+ * through write_lock and are the only ones who ever wait.
+ *
+ * The sockets of the connections being served are kept in clients, so
+ * that they can be shut down when the server stops.
+ */
+struct server_rec {
+    tree copies[2];
+    int readers[2];
+    int current;
+    pthread_mutex_t lock;
+    pthread_cond_t drained;
+    pthread_mutex_t write_lock;
+    int *clients;
+    int n_clients;
+    int clients_size;
+    pthread_cond_t gone;
+};
+
+struct connection {
+    struct server_rec *s;
+    int fd;
+};
+
+/**
+ * The signal handler writes a byte to the pipe in wake, which the loop
+ * accepting connections polls along with the socket. A signal arriving
+ * just before the loop waits leaves the byte in the pipe, so it still
+ * stops the server, where a flag checked before a blocking accept() would
+ * have been missed until the next connection.
+ */
+static int wake[2] = { -1, -1 };
+
+static void stop(int sig) {
+    int saved = errno;
+    (void) sig;
+    if (write(wake[1], "", 1) < 0) {
+        /* The pipe is full, so the server is already woken. */
+    }
+    errno = saved;
+}
+
+/**
+ * Counts a reader in to the current copy of the tree.
+ * Returns the index of the copy to read.
+ */
+static int reader_enter(struct server_rec *s) {
+    int i;
+    pthread_mutex_lock(&s->lock);
+    i = s->current;
+    s->readers[i]++;
+    pthread_mutex_unlock(&s->lock);
+    return i;
+}
+
+static void reader_exit(struct server_rec *s, int i) {
+    pthread_mutex_lock(&s->lock);
+    if (--s->readers[i] == 0 && i != s->current) {
+        pthread_cond_broadcast(&s->drained);
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+/**
+ * Splits a request line into its operation and word.
+ * Returns the operation, or 0 if the line isn't a request.
+ */
+static int request_parse(char *line, char **word) {
+    *word = line;
+    if (line[0] == '\0' || line[1] != ' ' || line[2] == '\0'
+        || strchr("cf+-!", line[0]) == NULL) {
+        return 0;
+    }
+    *word = line + 2;
+    return line[0];
+}
+
+static int request_writes(int op) {
+    return op == '+' || op == '-' || op == '!';
+}
+
+/**
+ * Carries out one request on t.
+ * Returns the reply to it.
+ */
+static int request_apply(tree t, int op, char *word) {
+    switch (op) {
+        case 'c':
+            return tree_search(t, word);
+        case '+':
+            tree_insert(t, word);
+            return tree_frequency(t, word);
+        case '-':
+            return tree_decrement(t, word);
+        case '!':
+            return tree_delete(t, word);
+        default:
+            return tree_frequency(t, word);
+    }
+}
+
+/**
+ * Makes the updates in the request lines from up to to, which are
+ * separated by nul characters, to both copies of the tree, writing the
+ * replies to out. See struct server_rec.
+ */
+static void server_update(struct server_rec *s, char *from, char *to, writer out) {
+    char *line, *word;
+    int next, op;
+
+    pthread_mutex_lock(&s->write_lock);
+    next = 1 - s->current;
+    for (line = from; line < to; line += strlen(line) + 1) {
+        op = request_parse(line, &word);
+        writer_int(out, request_apply(s->copies[next], op, word), 0);
+        writer_char(out, '\n');
+    }
+    pthread_mutex_lock(&s->lock);
+    s->current = next;
+    while (s->readers[1 - next] > 0) {
+        pthread_cond_wait(&s->drained, &s->lock);
+    }
+    pthread_mutex_unlock(&s->lock);
+    for (line = from; line < to; line += strlen(line) + 1) {
+        op = request_parse(line, &word);
+        request_apply(s->copies[1 - next], op, word);
+    }
+    pthread_mutex_unlock(&s->write_lock);
+}
+
+/**
+ * Answers a batch of len bytes of request lines, the last of which ends
+ * with a newline, writing the replies to out. Lookups are made on one copy
+ * of the tree for the whole batch, until a run of updates comes along,
+ * which is made as one update.
+ */
+static void server_batch(struct server_rec *s, char *text, size_t len, writer out) {
+    char *end = text + len, *line = text, *run, *word;
+    int op, held = -1;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (text[i] == '\n') {
+            text[i] = '\0';
+        }
+    }
+    while (line < end) {
+        op = request_parse(line, &word);
+        if (request_writes(op)) {
+            if (held >= 0) {
+                reader_exit(s, held);
+                held = -1;
+            }
+            run = line;
+            do {
+                line += strlen(line) + 1;
+            } while (line < end && request_writes(request_parse(line, &word)));
+            server_update(s, run, line, out);
+            continue;
+        }
+        if (op == 0) {
+            writer_str(out, "?\n");
+        } else {
+            if (held < 0) {
+                held = reader_enter(s);
+            }
+            writer_int(out, request_apply(s->copies[held], op, word), 0);
+            writer_char(out, '\n');
+        }
+        line += strlen(line) + 1;
+    }
+    if (held >= 0) {
+        reader_exit(s, held);
+    }
+}
+
+/**
+ * Serves one connection until the client closes it, answering whatever
+ * complete requests have arrived each time its socket is read. A request
+ * too long for the buffer is answered with ? and the rest of it ignored.
+ */
+static void *connection_main(void *arg) {
+    struct connection *c = arg;
+    struct server_rec *s = c->s;
+    int fd = c->fd, skipping = 0, i;
+    char *buf = emalloc(SERVER_BUFFER);
+    char *p;
+    size_t len = 0, start, end;
+    ssize_t got;
+    FILE *stream = fdopen(fd, "w");
+    writer out = (NULL == stream) ? NULL : writer_new(stream, SERVER_BUFFER);
+
+    free(c);
+    while (out != NULL
+           && ((got = read(fd, buf + len, SERVER_BUFFER - len)) > 0
+               || (got < 0 && errno == EINTR))) {
+        if (got < 0) {
+            continue;
+        }
+        len += got;
+        start = 0;
+        if (skipping) {
+            if (NULL == (p = memchr(buf, '\n', len))) {
+                len = 0;
+                continue;
+            }
+            start = p - buf + 1;
+            skipping = 0;
+        }
+        for (end = len; end > start && buf[end - 1] != '\n'; end--) {
+        }
+        if (end > start) {
+            server_batch(s, buf + start, end - start, out);
+        } else if (len == SERVER_BUFFER) {
+            writer_str(out, "?\n");
+            skipping = 1;
+            end = len;
+        }
+        memmove(buf, buf + end, len - end);
+        len -= end;
+        if (writer_flush(out) == EOF) {
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&s->lock);
+    for (i = 0; i < s->n_clients && s->clients[i] != fd; i++) {
+    }
+    s->clients[i] = s->clients[--s->n_clients];
+    if (s->n_clients == 0) {
+        pthread_cond_broadcast(&s->gone);
+    }
+    pthread_mutex_unlock(&s->lock);
+    if (out != NULL) {
+        writer_free(out);
+        fclose(stream);
+    } else {
+        close(fd);
+    }
+    free(buf);
+    return NULL;
+}
+
+/**
+ * Opens a Unix domain socket listening at path, first removing any socket
+ * left there by a server which has gone.
+ * Returns the socket, or -1 if it can't be opened.
+ */
+static int server_listen(char *path) {
+    struct sockaddr_un addr;
+    struct stat st;
+    int fd;
+
+    if (strlen(path) >= sizeof addr.sun_path) {
+        return -1;
+    }
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof addr) != 0
+        || listen(fd, SERVER_BACKLOG) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Serves requests about t on a Unix domain socket at path, see server.h,
+ * until the process is sent SIGINT or SIGTERM. Every connection is served
+ * by a thread of its own. Updates are made to t and to a copy of it, and
+ * t holds every update made once the server has stopped.
+ * Returns 0 when the server stops, or -1 if it couldn't listen at path.
+ */
+int server_run(tree t, char *path) {
+    struct server_rec s;
+    struct connection *c;
+    struct sigaction sa, old_int, old_term, old_pipe;
+    sigset_t block, old_mask;
+    pthread_attr_t attr;
+    pthread_t id;
+    struct pollfd fds[2];
+    int listener, fd, i;
+
+    if ((listener = server_listen(path)) < 0) {
+        return -1;
+    }
+    if (pipe(wake) != 0) {
+        close(listener);
+        unlink(path);
+        return -1;
+    }
+    fcntl(wake[1], F_SETFL, fcntl(wake[1], F_GETFL) | O_NONBLOCK);
+    fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+    memset(&sa, 0, sizeof sa);
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = stop;
+    sigaction(SIGINT, &sa, &old_int);
+    sigaction(SIGTERM, &sa, &old_term);
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, &old_pipe);
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+
+    s.copies[0] = t;
+    s.copies[1] = tree_copy(t);
+    s.readers[0] = s.readers[1] = 0;
+    s.current = 0;
+    s.clients_size = 16;
+    s.clients = emalloc(s.clients_size * sizeof s.clients[0]);
+    s.n_clients = 0;
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_mutex_init(&s.write_lock, NULL);
+    pthread_cond_init(&s.drained, NULL);
+    pthread_cond_init(&s.gone, NULL);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    fds[0].fd = listener;
+    fds[0].events = POLLIN;
+    fds[1].fd = wake[0];
+    fds[1].events = POLLIN;
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Failed to wait for a connection\n");
+            break;
+        }
+        if (fds[1].revents != 0) {
+            break;
+        }
+        if ((fd = accept(listener, NULL, NULL)) < 0) {
+            if (errno == EINTR || errno == ECONNABORTED
+                || errno == EAGAIN || errno == EWOULDBLOCK) {
+                continue;
+            }
+            fprintf(stderr, "Failed to accept connection\n");
+            break;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+        pthread_mutex_lock(&s.lock);
+        if (s.n_clients == s.clients_size) {
+            s.clients_size *= 2;
+            s.clients = erealloc(s.clients, s.clients_size * sizeof s.clients[0]);
+        }
+        s.clients[s.n_clients++] = fd;
+        pthread_mutex_unlock(&s.lock);
+        c = emalloc(sizeof *c);
+        c->s = &s;
+        c->fd = fd;
+        pthread_sigmask(SIG_BLOCK, &block, &old_mask);
+        if (pthread_create(&id, &attr, connection_main, c) != 0) {
+            fprintf(stderr, "Failed to create thread\n");
+            exit(EXIT_FAILURE);
+        }
+        pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    }
+
+    close(listener);
+    unlink(path);
+    pthread_mutex_lock(&s.lock);
+    for (i = 0; i < s.n_clients; i++) {
+        shutdown(s.clients[i], SHUT_RDWR);
+    }
+    while (s.n_clients > 0) {
+        pthread_cond_wait(&s.gone, &s.lock);
+    }
+    pthread_mutex_unlock(&s.lock);
+
+    pthread_attr_destroy(&attr);
+    pthread_cond_destroy(&s.gone);
+    pthread_cond_destroy(&s.drained);
+    pthread_mutex_destroy(&s.write_lock);
+    pthread_mutex_destroy(&s.lock);
+    free(s.clients);
+    tree_free(s.copies[1]);
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+    sigaction(SIGPIPE, &old_pipe, NULL);
+    close(wake[0]);
+    close(wake[1]);
+    wake[0] = wake[1] = -1;
+    return 0;
+}
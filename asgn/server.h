@@ -0,0 +1,31 @@
+/**
+ * @file server.h
+ *
+ * A word-count server keeps a dictionary tree in memory and answers
+ * requests about it from other processes over a Unix domain socket, so
+ * the tree is built once however many documents are checked against it.
+ *
+ * Each request is one line holding an operation, a space and a word:
+ *
+ *    c WORD    check WORD, the reply is 1 if it is known and 0 if not
+ *    f WORD    the reply is the frequency of WORD, 0 if it is unknown
+ *    + WORD    insert WORD once, the reply is its new frequency
+ *    - WORD    remove one occurrence of WORD, the reply is its remaining
+ *              frequency, or -1 if it wasn't there
+ *    ! WORD    delete WORD outright, the reply is 1 if it was there
+ *
+ * Every request gets a reply line, in order, with ? for a request which
+ * can't be understood. Words are looked up as they are given, so a client
+ * should split and lowercase its text as asgn2 does. A client can send
+ * any number of requests before reading the replies, and the requests
+ * which arrive together are answered as one batch.
+ */
+
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include "tree.h"
+
+extern int server_run(tree t, char *path);
+
+#endif
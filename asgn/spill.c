@@ -0,0 +1,254 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include "spill.h"
+#include "mylib.h"
+
+/**
+ * SPILL_FANIN is the most runs kept at once, so no more files than this
+ * are ever open and no merge reads more than this many at a time. Runs are
+ * merged in tiers: a run written from a tree is on level 0, and as soon as
+ * there are SPILL_TIER runs on one level they are merged into one run on
+ * the next, so each word is written again once per level, about
+ * log(runs) / log(SPILL_TIER) times, rather than at every merge. There are
+ * fewer than SPILL_TIER runs on each level, and only past SPILL_FANIN /
+ * (SPILL_TIER - 1) levels, over a hundred million runs, are they all
+ * merged into one to make room. SPILL_BUFFER is the size of the buffer a
+ * run is written through.
+ */
+#define SPILL_FANIN 64
+#define SPILL_TIER 8
+#define SPILL_BUFFER (1 << 16)
+
+/**
+ * A run is an anonymous temporary file, which goes away when it is closed,
+ * holding a line for each of its words in sorted order: the frequency, a
+ * space and the word. The runs are kept oldest first, with their levels,
+ * which never go up from one run to the next. written counts every run
+ * made from a tree, including those since merged into others.
+ */
+struct spill_rec {
+    FILE *runs[SPILL_FANIN];
+    int levels[SPILL_FANIN];
+    int n_runs;
+    int written;
+};
+
+/**
+ * A cursor is how far a merge has got through one run, holding the line
+ * last read from it split into its frequency and word.
+ */
+struct run_cursor {
+    FILE *in;
+    char *line;
+    size_t size;
+    char *word;
+    int freq;
+};
+
+/* The run being written by run_line(), which tree_inorder() calls. */
+static writer run_out;
+
+static void run_line(int freq, char *str) {
+    writer_int(run_out, freq, 0);
+    writer_char(run_out, ' ');
+    writer_str(run_out, str);
+    writer_char(run_out, '\n');
+}
+
+/**
+ * Finishes writing the run open in run_out and adds it to s on level.
+ * Returns 0, or EOF if the run couldn't be written.
+ */
+static int run_keep(spill s, FILE *run, int level) {
+    int failed = (writer_flush(run_out) == EOF);
+    run_out = writer_free(run_out);
+    if (failed) {
+        fclose(run);
+        return EOF;
+    }
+    s->levels[s->n_runs] = level;
+    s->runs[s->n_runs++] = run;
+    return 0;
+}
+
+/**
+ * Reads the next line of a cursor's run.
+ * Returns 0, or EOF at the end of the run.
+ */
+static int cursor_next(struct run_cursor *c) {
+    ssize_t len = getline(&c->line, &c->size, c->in);
+    char *p;
+    if (len <= 0) {
+        return EOF;
+    }
+    if (c->line[len - 1] == '\n') {
+        c->line[len - 1] = '\0';
+    }
+    c->freq = (int)strtol(c->line, &p, 10);
+    c->word = (*p == ' ') ? p + 1 : p;
+    return 0;
+}
+
+/**
+ * Moves the cursor at i of a heap of n cursors down until neither of its
+ * children has a word before its own.
+ */
+static void cursor_sift(struct run_cursor **heap, int n, int i) {
+    struct run_cursor *c = heap[i];
+    int child;
+    while ((child = 2 * i + 1) < n) {
+        if (child + 1 < n && strcmp(heap[child + 1]->word, heap[child]->word) < 0) {
+            child++;
+        }
+        if (strcmp(heap[child]->word, c->word) >= 0) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = c;
+}
+
+/**
+ * Merges the runs of s from first on, calling f with each word in sorted
+ * order and the sum of its frequencies in those runs. The runs are left as
+ * they were.
+ * Returns 0, or EOF if a run couldn't be read.
+ */
+static int runs_merge(spill s, int first, void f(int freq, char *str)) {
+    struct run_cursor cursors[SPILL_FANIN];
+    struct run_cursor *heap[SPILL_FANIN];
+    char *word = NULL;
+    size_t word_size = 0, len;
+    int n = 0, i, freq, result = 0;
+
+    for (i = first; i < s->n_runs; i++) {
+        rewind(s->runs[i]);
+        cursors[i].in = s->runs[i];
+        cursors[i].line = NULL;
+        cursors[i].size = 0;
+        if (cursor_next(&cursors[i]) == 0) {
+            heap[n++] = &cursors[i];
+        }
+    }
+    for (i = n / 2 - 1; i >= 0; i--) {
+        cursor_sift(heap, n, i);
+    }
+    while (n > 0) {
+        len = strlen(heap[0]->word) + 1;
+        if (len > word_size) {
+            word_size = 2 * len;
+            word = erealloc(word, word_size);
+        }
+        memcpy(word, heap[0]->word, len);
+        freq = 0;
+        while (n > 0 && strcmp(heap[0]->word, word) == 0) {
+            freq += heap[0]->freq;
+            if (cursor_next(heap[0]) == EOF) {
+                heap[0] = heap[--n];
+            }
+            cursor_sift(heap, n, 0);
+        }
+        f(freq, word);
+    }
+
+    for (i = first; i < s->n_runs; i++) {
+        if (ferror(s->runs[i])) {
+            result = EOF;
+        }
+        free(cursors[i].line);
+    }
+    free(word);
+    return result;
+}
+
+/**
+ * Merges the runs of s from first on into one new run, which replaces
+ * them on the level above the first of them.
+ * Returns 0, or EOF if the runs couldn't be read or the new one written.
+ */
+static int runs_collapse(spill s, int first) {
+    FILE *run = tmpfile();
+    int i, merged, level = s->levels[first] + 1;
+    if (NULL == run) {
+        return EOF;
+    }
+    run_out = writer_new(run, SPILL_BUFFER);
+    merged = runs_merge(s, first, run_line);
+    for (i = first; i < s->n_runs; i++) {
+        fclose(s->runs[i]);
+    }
+    s->n_runs = first;
+    if (run_keep(s, run, level) == EOF || merged == EOF) {
+        return EOF;
+    }
+    return 0;
+}
+
+spill spill_new(void) {
+    spill s = emalloc(sizeof *s);
+    s->n_runs = 0;
+    s->written = 0;
+    return s;
+}
+
+/**
+ * Writes the words of t and their frequencies to a new run, leaving t as
+ * it was for the caller to free.
+ * Returns 0, or EOF if the run couldn't be written.
+ */
+int spill_tree(spill s, tree t) {
+    FILE *run;
+    int top;
+    if (s->n_runs == SPILL_FANIN && runs_collapse(s, 0) == EOF) {
+        return EOF;
+    }
+    if (NULL == (run = tmpfile())) {
+        return EOF;
+    }
+    run_out = writer_new(run, SPILL_BUFFER);
+    tree_inorder(t, run_line);
+    s->written++;
+    if (run_keep(s, run, 0) == EOF) {
+        return EOF;
+    }
+    while ((top = s->n_runs - SPILL_TIER) >= 0
+           && s->levels[top] == s->levels[s->n_runs - 1]) {
+        if (runs_collapse(s, top) == EOF) {
+            return EOF;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Returns the number of trees written out with spill_tree().
+ */
+int spill_runs(spill s) {
+    return s->written;
+}
+
+/**
+ * Calls f with every word of every tree written out so far, in sorted
+ * order, and the sum of its frequencies in those trees.
+ * Returns 0, or EOF if the runs couldn't be read.
+ */
+int spill_merge(spill s, void f(int freq, char *str)) {
+    return runs_merge(s, 0, f);
+}
+
+spill spill_free(spill s) {
+    int i;
+    if (NULL == s) {
+        return NULL;
+    }
+    for (i = 0; i < s->n_runs; i++) {
+        fclose(s->runs[i]);
+    }
+    free(s);
+    return NULL;
+}
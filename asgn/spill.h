@@ -0,0 +1,26 @@
+/**
+ * @file spill.h
+ *
+ * Counting the words of a text too big for its tree to fit in memory. A
+ * tree which has grown too big is written out as a run, a temporary file
+ * of its words in sorted order with their frequencies, and can then be
+ * freed and started again. Once the text has all been read the runs are
+ * merged, adding up the frequencies of a word found in several of them,
+ * to give the same words and frequencies one big tree would have held.
+ * Only a buffer for each run is kept in memory while they are merged.
+ */
+
+#ifndef SPILL_H_
+#define SPILL_H_
+
+#include "tree.h"
+
+typedef struct spill_rec *spill;
+
+extern spill spill_new(void);
+extern int spill_tree(spill s, tree t);
+extern int spill_runs(spill s);
+extern int spill_merge(spill s, void f(int freq, char *str));
+extern spill spill_free(spill s);
+
+#endif
@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "suggest.h"
+#include "mylib.h"
+
+/**
+ * Only words up to SUGGEST_MAX_LEN letters are indexed or given
+ * suggestions, since a word of n letters has about n * n / 2 ways of
+ * deleting two letters. SUGGEST_MAX_DISTANCE is the largest distance an
+ * index can be built for, and SUGGEST_MAX_DELETES the most strings a word
+ * can become by deleting up to that many letters.
+ */
+#define SUGGEST_MAX_LEN 32
+#define SUGGEST_MAX_DISTANCE 2
+#define SUGGEST_MAX_DELETES (1 + SUGGEST_MAX_LEN + SUGGEST_MAX_LEN * (SUGGEST_MAX_LEN - 1) / 2)
+
+/**
+ * The index is a symmetric delete index: every dictionary word is stored
+ * under each string it becomes when up to distance of its letters are
+ * deleted. Two words within that distance of each other can always both be
+ * turned into the same string this way, so the candidates for a word are
+ * just the dictionary words stored under its own deletes, and only those
+ * few are compared with it letter by letter.
+ *
+ * Rather than the strings themselves an entry keeps a 32-bit hash of the
+ * delete, and the entries are sorted by hash so those for a delete can be
+ * found by binary search. A hash can be shared by unrelated deletes, but
+ * every candidate is checked with its real distance anyway.
+ */
+struct suggest_entry {
+    unsigned int hash;
+    unsigned int word;
+};
+
+struct dict_word {
+    char *str;
+    int len;
+    int frequency;
+};
+
+struct suggest_rec {
+    struct suggest_entry *entries;
+    size_t n_entries;
+    struct dict_word *words;
+    int n_words;
+    int distance;
+    unsigned int *seen;
+    unsigned int stamp;
+    arena strings;
+};
+
+/**
+ * Works out the FNV-1a hash of str with the letters at i and j left out,
+ * where either can be -1 to leave nothing out.
+ */
+static unsigned int delete_hash(const char *str, int len, int i, int j) {
+    unsigned int h = 2166136261u;
+    int k;
+    for (k = 0; k < len; k++) {
+        if (k != i && k != j) {
+            h = (h ^ (unsigned char)str[k]) * 16777619u;
+        }
+    }
+    return h & 0xFFFFFFFFu;
+}
+
+static int hash_cmp(const void *a, const void *b) {
+    unsigned int x = *(const unsigned int *)a;
+    unsigned int y = *(const unsigned int *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Fills hashes with the hashes of every string str becomes when up to
+ * distance of its letters are deleted, including str itself, sorted and
+ * without repeats. Returns how many there are.
+ */
+static int deletes(const char *str, int len, int distance, unsigned int *hashes) {
+    int n = 0;
+    int i, j, k;
+    hashes[n++] = delete_hash(str, len, -1, -1);
+    for (i = 0; distance >= 1 && i < len; i++) {
+        hashes[n++] = delete_hash(str, len, i, -1);
+        for (j = i + 1; distance >= 2 && j < len; j++) {
+            hashes[n++] = delete_hash(str, len, i, j);
+        }
+    }
+    qsort(hashes, n, sizeof hashes[0], hash_cmp);
+    for (i = 1, k = 1; i < n; i++) {
+        if (hashes[i] != hashes[k - 1]) {
+            hashes[k++] = hashes[i];
+        }
+    }
+    return k;
+}
+
+/**
+ * Sorts the entries by hash with two passes of a 16-bit radix sort, which
+ * keeps the entries for each hash in word order.
+ */
+static void entries_sort(struct suggest_entry *entries, size_t n) {
+    struct suggest_entry *tmp = emalloc((n > 0 ? n : 1) * sizeof tmp[0]);
+    struct suggest_entry *from = entries, *to = tmp, *swap;
+    size_t *count = emalloc(65537 * sizeof count[0]);
+    size_t i;
+    int shift, b;
+    for (shift = 0; shift < 32; shift += 16) {
+        memset(count, 0, 65537 * sizeof count[0]);
+        for (i = 0; i < n; i++) {
+            count[((from[i].hash >> shift) & 0xFFFF) + 1]++;
+        }
+        for (b = 0; b < 65536; b++) {
+            count[b + 1] += count[b];
+        }
+        for (i = 0; i < n; i++) {
+            to[count[(from[i].hash >> shift) & 0xFFFF]++] = from[i];
+        }
+        swap = from;
+        from = to;
+        to = swap;
+    }
+    free(count);
+    free(tmp);
+}
+
+/**
+ * Builds a suggestion index of the words in t which finds words up to
+ * distance edits away, where distance is 1 or 2. The words are copied, so
+ * the tree can be changed or freed afterwards.
+ */
+suggest suggest_new(tree t, int distance) {
+    unsigned int hashes[SUGGEST_MAX_DELETES];
+    suggest s = emalloc(sizeof *s);
+    size_t size = 1024;
+    int i, j, n, len, freq;
+    char *word;
+
+    if (distance < 1) {
+        distance = 1;
+    } else if (distance > SUGGEST_MAX_DISTANCE) {
+        distance = SUGGEST_MAX_DISTANCE;
+    }
+    s->distance = distance;
+    s->strings = arena_new(1 << 20);
+    s->words = emalloc((tree_size(t) + 1) * sizeof s->words[0]);
+    s->n_words = 0;
+    s->entries = emalloc(size * sizeof s->entries[0]);
+    s->n_entries = 0;
+    for (i = 0; i < tree_size(t); i++) {
+        word = tree_word(t, i, &freq);
+        len = strlen(word);
+        if (len > SUGGEST_MAX_LEN) {
+            continue;
+        }
+        n = deletes(word, len, distance, hashes);
+        while (s->n_entries + n > size) {
+            size *= 2;
+            s->entries = erealloc(s->entries, size * sizeof s->entries[0]);
+        }
+        for (j = 0; j < n; j++) {
+            s->entries[s->n_entries].hash = hashes[j];
+            s->entries[s->n_entries].word = s->n_words;
+            s->n_entries++;
+        }
+        s->words[s->n_words].str = arena_strdup(s->strings, word);
+        s->words[s->n_words].len = len;
+        s->words[s->n_words].frequency = freq;
+        s->n_words++;
+    }
+    entries_sort(s->entries, s->n_entries);
+    s->seen = emalloc((s->n_words + 1) * sizeof s->seen[0]);
+    memset(s->seen, 0, (s->n_words + 1) * sizeof s->seen[0]);
+    s->stamp = 0;
+    return s;
+}
+
+/**
+ * Works out the distance between a and b, counting inserted, deleted and
+ * changed letters and swapped neighbouring letters, giving up as soon as
+ * it must be more than max. Returns max + 1 in that case.
+ */
+static int edit_distance(const char *a, int la, const char *b, int lb, int max) {
+    int rows[3][SUGGEST_MAX_LEN + 1];
+    int *prev2 = rows[0], *prev = rows[1], *cur = rows[2], *swap;
+    int i, j, d, lowest;
+    if (la - lb > max || lb - la > max) {
+        return max + 1;
+    }
+    for (j = 0; j <= lb; j++) {
+        prev[j] = j;
+    }
+    for (i = 1; i <= la; i++) {
+        cur[0] = i;
+        lowest = i;
+        for (j = 1; j <= lb; j++) {
+            d = prev[j - 1] + (a[i - 1] != b[j - 1]);
+            if (prev[j] + 1 < d) {
+                d = prev[j] + 1;
+            }
+            if (cur[j - 1] + 1 < d) {
+                d = cur[j - 1] + 1;
+            }
+            if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1]
+                && prev2[j - 2] + 1 < d) {
+                d = prev2[j - 2] + 1;
+            }
+            cur[j] = d;
+            if (d < lowest) {
+                lowest = d;
+            }
+        }
+        if (lowest > max) {
+            return max + 1;
+        }
+        swap = prev2;
+        prev2 = prev;
+        prev = cur;
+        cur = swap;
+    }
+    return prev[lb];
+}
+
+/**
+ * Says whether dictionary word x at distance dx is a better suggestion
+ * than word y at distance dy: closer first, then more frequent, then in
+ * sorted order.
+ */
+static int better(suggest s, int x, int dx, int y, int dy) {
+    if (dx != dy) {
+        return dx < dy;
+    }
+    if (s->words[x].frequency != s->words[y].frequency) {
+        return s->words[x].frequency > s->words[y].frequency;
+    }
+    return strcmp(s->words[x].str, s->words[y].str) < 0;
+}
+
+/**
+ * Finds up to limit dictionary words within the index's distance of word,
+ * not counting word itself, and stores them in out best first. The words
+ * stay valid until the index is freed. An index can only be used by one
+ * thread at a time.
+ * Returns the number of suggestions found.
+ */
+int suggest_word(suggest s, char *word, char **out, int limit) {
+    unsigned int hashes[SUGGEST_MAX_DELETES];
+    int best[SUGGEST_MAX_DELETES];
+    int best_dist[SUGGEST_MAX_DELETES];
+    int len = strlen(word);
+    int found = 0;
+    int i, j, n, w, d;
+    size_t lo, hi, mid;
+
+    if (len > SUGGEST_MAX_LEN || limit <= 0) {
+        return 0;
+    }
+    if (limit > SUGGEST_MAX_DELETES) {
+        limit = SUGGEST_MAX_DELETES;
+    }
+    if (++s->stamp == 0) {
+        memset(s->seen, 0, (s->n_words + 1) * sizeof s->seen[0]);
+        s->stamp = 1;
+    }
+    n = deletes(word, len, s->distance, hashes);
+    for (i = 0; i < n; i++) {
+        lo = 0;
+        hi = s->n_entries;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (s->entries[mid].hash < hashes[i]) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        for (; lo < s->n_entries && s->entries[lo].hash == hashes[i]; lo++) {
+            w = s->entries[lo].word;
+            if (s->seen[w] == s->stamp) {
+                continue;
+            }
+            s->seen[w] = s->stamp;
+            d = edit_distance(word, len, s->words[w].str, s->words[w].len, s->distance);
+            if (d == 0 || d > s->distance) {
+                continue;
+            }
+            if (found == limit && !better(s, w, d, best[found - 1], best_dist[found - 1])) {
+                continue;
+            }
+            j = (found < limit) ? found++ : found - 1;
+            for (; j > 0 && better(s, w, d, best[j - 1], best_dist[j - 1]); j--) {
+                best[j] = best[j - 1];
+                best_dist[j] = best_dist[j - 1];
+            }
+            best[j] = w;
+            best_dist[j] = d;
+        }
+    }
+    for (i = 0; i < found; i++) {
+        out[i] = s->words[best[i]].str;
+    }
+    return found;
+}
+
+suggest suggest_free(suggest s) {
+    if (s != NULL) {
+        free(s->entries);
+        free(s->words);
+        free(s->seen);
+        arena_free(s->strings);
+        free(s);
+    }
+    return NULL;
+}
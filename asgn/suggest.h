@@ -0,0 +1,22 @@
+/**
+ * @file suggest.h
+ *
+ * Spelling suggestions for words which are not in a dictionary tree. A
+ * suggest index is built once from the words of a tree, after which
+ * suggest_word() finds the dictionary words within a small edit distance of
+ * any word, closest first and then most frequent first. The distance counts
+ * inserted, deleted and changed letters and swapped neighbouring letters.
+ */
+
+#ifndef SUGGEST_H_
+#define SUGGEST_H_
+
+#include "tree.h"
+
+typedef struct suggest_rec *suggest;
+
+extern suggest suggest_new(tree t, int distance);
+extern int suggest_word(suggest s, char *word, char **out, int limit);
+extern suggest suggest_free(suggest s);
+
+#endif
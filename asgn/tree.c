@@ -9,348 +9,2469 @@
  * and perform the required functions on a created tree data structure. 
  * This provides methods such as tree_new(), tree_insert(), right_rotate(), 
  * left_rotate(), tree_search(), tree_depth(), tree_fix(), tree_preorder(). 
+ *
+ * Every function takes a tree handle which holds the root node, the kind
+ * of tree, the node count, and the array and pool the nodes and keys
+ * live in. There is no
+ * state shared between handles, so any number of independent trees may be
+ * used at once, including from different threads as long as each tree is
+ * only modified by one thread at a time. A tree passed to tree_share() can
+ * also be changed while other threads search it.
 
  * 
  * This file also provides functions for creating dot representations of
  * created BST or RBT data structures.
+ *
+ * A tree can also be created as a HASH, an open addressing hash table which
+ * offers the same insert, search and frequency functions. Its keys live in
+ * the same node array and key pool as a tree's; the table only maps hashes
+ * to node indexes.
+ *
+ * Because a tree is nothing but these few flat blocks, tree_save() can
+ * write it to a file as they are and tree_load() can map that file straight
+ * back into memory as a working tree.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sched.h>
+#include "tree.h"
+#include "mylib.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FROZEN_SIMD
+#include <emmintrin.h>
+#endif
+
+/**
+ * Nodes live in one array owned by the tree and refer to each other by
+ * 32-bit index rather than by pointer. Index 0 (NIL) is a sentinel node
+ * which stands in for an empty subtree; it is always black, so the colour
+ * of a missing child can be read without checking for it first.
+ */
+#define NIL 0
+
+/**
+ * Each node keeps the first TREE_PREFIX bytes of its key, zero padded, as
+ * TREE_PREFIX_WORDS big-endian integers. Comparing two prefixes this way
+ * gives the same order as strcmp(), so most comparisons are settled
+ * without looking at the full key, and keys which fit in the prefix are
+ * never looked at at all.
+ */
+#define TREE_PREFIX_WORDS 3
+#define TREE_PREFIX (4 * TREE_PREFIX_WORDS)
+
+/**
+ * The node array and the key pool start this big and double when full.
+ */
+#define TREE_INITIAL_NODES 1024
+#define TREE_INITIAL_KEYS 16384
+
+/**
+ * The slot table of a HASH starts this big and doubles whenever it becomes
+ * half full, which keeps linear probe sequences short.
+ */
+#define HASH_INITIAL_SLOTS 1024
+
+/**
+ * An RBT holding n nodes is never more than 2 * log2(n + 1) levels deep, so
+ * this comfortably bounds the path tree_insert() and tree_remove() record on
+ * the way down.
+ */
+#define TREE_MAX_PATH 128
+
+/**
+ * The size of the buffer tree_output_dot() collects its output in.
+ */
+#define TREE_WRITER_SIZE (1 << 16)
+
+/**
+ * Searches of a shared tree are made without taking its lock when the
+ * compiler offers a memory barrier, see tree_share(). A search which keeps
+ * running into changes gives up after TREE_OPTIMISTIC_TRIES attempts and
+ * waits for the lock instead.
+ */
+#if defined(__GNUC__)
+#define TREE_OPTIMISTIC
+#define TREE_BARRIER() __sync_synchronize()
+#else
+#define TREE_BARRIER() ((void) 0)
+#endif
+#define TREE_OPTIMISTIC_TRIES 8
+
+/**
+ * Each block of a frozen tree, see struct tree_frozen, holds FROZEN_B keys,
+ * which makes its first prefix words fill one 64-byte cache line.
+ * FROZEN_MAX_LEVELS is more levels than any number of keys needs.
+ */
+#define FROZEN_B 16
+#define FROZEN_MAX_LEVELS 16
+
+typedef unsigned int node;
+
+/**
+ * A node is 40 bytes. The colour is kept in the low bit of info and the
+ * length of the key in the rest of it. In a BST or an RBT, count is the
+ * number of nodes in the subtree rooted at the node and total is the sum of
+ * their frequencies, which lets tree_rank() and tree_select() find their
+ * way down the tree without visiting whole subtrees.
+ */
+struct tree_node{
+    unsigned int prefix[TREE_PREFIX_WORDS];
+    unsigned int key;
+    node left; 
+    node right;
+    int frequency;
+    unsigned int info;
+    unsigned int count;
+    unsigned int total;
+};
+
+/**
+ * A slot in a HASH holds the full hash of a key alongside its node, so
+ * probing can skip most non-matching keys, and the table can be grown,
+ * without looking at the keys themselves. Empty slots have x == NIL.
+ */
+struct tree_slot {
+    unsigned int hash;
+    node x;
+};
+
+/**
+ * A shared tree is changed by one thread at a time, holding lock, and
+ * version is odd while a change is being made. Searches don't take the
+ * lock; they note the version, search, and start again if the version has
+ * changed since. Arrays replaced while the tree grows may still be being
+ * read by such a search, so they are kept in retired until the tree is
+ * freed rather than freed straight away.
+ */
+struct tree_sync {
+    pthread_mutex_t lock;
+    volatile unsigned int version;
+    void **retired;
+    int n_retired;
+    int retired_size;
+};
+
+/**
+ * A frozen tree is searched through a static B+ tree of its keys, built
+ * by tree_freeze(), rather than through its nodes. Every level is an array
+ * of blocks of FROZEN_B keys, and level 0 holds every key in sorted
+ * order. Each block above has FROZEN_B + 1 children in the level below,
+ * and holds the smallest key under each child but the first, so a search
+ * goes to the child after the last key not greater than the one it wants.
+ * A key is kept as the node which holds it, in refs, with the first two
+ * words of the node's prefix beside it in first and second, so a block is
+ * searched by comparing first words, 16 at once, and a node is only
+ * looked at when both words match. The first words are stored with their
+ * top bit flipped, so that SSE2's signed comparisons order them as
+ * unsigned. Unused keys at the end of a level are NIL, with first and
+ * second words which sort after any key's.
+ */
+struct tree_frozen {
+    unsigned int *first;
+    unsigned int *second;
+    node *refs;
+    void *block;
+    int levels;
+    unsigned int start[FROZEN_MAX_LEVELS];
+};
+
+struct tree_rec {
+    node root;
+    tree_t type;
+    int size;
+    struct tree_node *nodes;
+    unsigned int capacity;
+    char *keys;
+    size_t keys_len;
+    size_t keys_size;
+    struct tree_slot *slots;
+    unsigned int slot_mask;
+    void *map;
+    size_t map_len;
+    struct tree_sync *sync;
+    struct tree_frozen *frozen;
+};
+
+/**
+ * A snapshot file starts with this header, padded to SNAPSHOT_HEADER_SIZE
+ * bytes, followed by the node array, the key pool padded to a multiple of
+ * 8 bytes, and for a HASH the slot table. Every field is stored in the
+ * byte order of the machine which wrote it; the byte_order field lets
+ * tree_load() reject snapshots from a machine with a different one.
+ */
+#define SNAPSHOT_MAGIC "TREESNAP"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+#define SNAPSHOT_HEADER_SIZE 64
+#define SNAPSHOT_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+struct snapshot_header {
+    char magic[8];
+    unsigned int version;
+    unsigned int byte_order;
+    unsigned int node_size;
+    unsigned int type;
+    unsigned int root;
+    unsigned int size;
+    unsigned int keys_len;
+    unsigned int slot_mask;
+};
+
+/**
+ * A string being searched for or inserted, with its prefix worked out once
+ * up front rather than at every node.
+ */
+struct tree_key {
+    unsigned int prefix[TREE_PREFIX_WORDS];
+    size_t len;
+    char *str;
+};
+
+/**
+ * NODE, LEFT, RIGHT and KEY look up the parts of a node by its index.
+ * IS_BLACK & IS_RED indicate the state of tree data structure node colour.
+ * These statements evaluate the colour of individual tree data structure
+ * nodes, the use of these statements are in the tree_fix() function.
+ */
+
+#define NODE(t, x) ((t)->nodes[x])
+#define LEFT(t, x) (NODE(t, x).left)
+#define RIGHT(t, x) (NODE(t, x).right)
+#define KEY(t, x) ((t)->keys + NODE(t, x).key)
+#define KEY_LEN(t, x) (NODE(t, x).info >> 1)
+#define COLOUR(t, x) ((tree_colour)(NODE(t, x).info & 1))
+#define SET_COLOUR(t, x, c) (NODE(t, x).info = (NODE(t, x).info & ~1u) | (c))
+#define IS_BLACK(t, x) (BLACK == COLOUR(t, x))
+#define IS_RED(t, x) (RED == COLOUR(t, x))
+
+/**
+ * RECOLOUR is SET_COLOUR for the fixups after an insert or a removal, which
+ * are counted when built with -DSTATS.
+ */
+#define RECOLOUR(t, x, c) (STATS_ADD(STAT_RECOLOURS, 1), SET_COLOUR(t, x, c))
+
+static node tree_fix(tree t, node x);
+
+/**
+ * Function: tree_update()
+ * @param: tree t, node x
+ * Procedure: Works out the count and total of node x again from those of
+ * its children, which must already be right. NIL has a count and total of
+ * zero, so it needs no special case.
+ */
+
+static void tree_update(tree t, node x) {
+    NODE(t, x).count = 1 + NODE(t, LEFT(t, x)).count + NODE(t, RIGHT(t, x)).count;
+    NODE(t, x).total = NODE(t, x).frequency
+        + NODE(t, LEFT(t, x)).total + NODE(t, RIGHT(t, x)).total;
+}
+
+/**
+ * Function: tree_new()
+ * @param: tree_t type
+ * This indicates if the to be created data structure is a BST or an RBT.
+ * Output: 
+ * A tree data structure, either an RBT or a BST.
+ * Procedure: Allocates the tree handle, the node array with its NIL
+ * sentinel, and the pool which will hold the keys, plus the slot table if
+ * the tree is a HASH;
+ * @return An empty tree data structure (no nodes or associated key values)
+ */
+tree tree_new(tree_t type) { 
+    tree t = emalloc(sizeof *t);
+    t->root = NIL;
+    t->type = type;
+    t->size = 0;
+    t->capacity = TREE_INITIAL_NODES;
+    t->nodes = emalloc(t->capacity * sizeof t->nodes[0]);
+    memset(&NODE(t, NIL), 0, sizeof t->nodes[0]);
+    SET_COLOUR(t, NIL, BLACK);
+    t->keys_size = TREE_INITIAL_KEYS;
+    t->keys = emalloc(t->keys_size);
+    t->keys[0] = '\0';
+    t->keys_len = 1;
+    t->slots = NULL;
+    t->slot_mask = 0;
+    t->map = NULL;
+    t->map_len = 0;
+    t->sync = NULL;
+    t->frozen = NULL;
+    if (type == HASH) {
+        t->slots = emalloc(HASH_INITIAL_SLOTS * sizeof t->slots[0]);
+        memset(t->slots, 0, HASH_INITIAL_SLOTS * sizeof t->slots[0]);
+        t->slot_mask = HASH_INITIAL_SLOTS - 1;
+    }
+    return t;
+}
+
+/**
+ * Function: key_init()
+ * @param: struct tree_key *k, char *str
+ * Procedure: Fills in k for the string str, packing its first TREE_PREFIX
+ * bytes into big-endian integers with zeros after the end of the string.
+ */
+
+static void key_init(struct tree_key *k, char *str) {
+    const unsigned char *s = (const unsigned char *)str;
+    unsigned int w;
+    int i, j;
+    for (i = 0; i < TREE_PREFIX_WORDS; i++) {
+        w = 0;
+        for (j = 0; j < 4; j++) {
+            w <<= 8;
+            if (*s != '\0') {
+                w |= *s++;
+            }
+        }
+        k->prefix[i] = w;
+    }
+    k->len = (s - (const unsigned char *)str) + strlen((const char *)s);
+    k->str = str;
+}
+
+/**
+ * Function: key_cmp()
+ * @param: tree t, struct tree_key *k, node x
+ * Procedure: Compares a key against the key of node x using the prefixes
+ * first. Only if the prefixes match and one of the keys is longer than the
+ * prefix are the rest of the strings compared.
+ * @return less than, equal to or greater than zero as for strcmp().
+ */
+
+static int key_cmp(tree t, struct tree_key *k, node x) {
+    const unsigned int *p = NODE(t, x).prefix;
+    int i;
+    for (i = 0; i < TREE_PREFIX_WORDS; i++) {
+        if (k->prefix[i] != p[i]) {
+            return (k->prefix[i] < p[i]) ? -1 : 1;
+        }
+    }
+    if (k->len <= TREE_PREFIX && KEY_LEN(t, x) <= TREE_PREFIX) {
+        return 0;
+    }
+    STATS_ADD(STAT_FULL_COMPARES, 1);
+    return strcmp(k->str + TREE_PREFIX, KEY(t, x) + TREE_PREFIX);
+}
+
+/**
+ * Function: tree_retire()
+ * @param: tree t, void *old
+ * Procedure: Frees an array the tree no longer uses. A search of a shared
+ * tree may still be reading it, so then it is only retired, see struct
+ * tree_sync.
+ */
+
+static void tree_retire(tree t, void *old) {
+    struct tree_sync *s = t->sync;
+    if (NULL == s) {
+        free(old);
+        return;
+    }
+    if (s->n_retired == s->retired_size) {
+        s->retired_size *= 2;
+        s->retired = erealloc(s->retired, s->retired_size * sizeof s->retired[0]);
+    }
+    s->retired[s->n_retired++] = old;
+}
+
+/**
+ * Function: tree_grow()
+ * @param: tree t, void *old, size_t old_size, size_t new_size
+ * Procedure: Makes one of the tree's arrays bigger. For a shared tree the
+ * new part is zeroed, so that a search which reads it before it is filled
+ * in always finds the nul at the end of the key pool.
+ * @return the array, which may have moved.
+ */
+
+static void *tree_grow(tree t, void *old, size_t old_size, size_t new_size) {
+    char *result;
+    if (NULL == t->sync) {
+        return erealloc(old, new_size);
+    }
+    result = emalloc(new_size);
+    memcpy(result, old, old_size);
+    memset(result + old_size, 0, new_size - old_size);
+    tree_retire(t, old);
+    return result;
+}
+
+/**
+ * Function: tree_node_new()
+ * @param: tree t, struct tree_key *k, int freq
+ * The t variable is the tree the new node will belong to.
+ * The k variable holds the string to be stored in the new node.
+ * The freq variable is the starting frequency of the string.
+ *
+ * Procedure: Takes the next node from the tree's node array and copies the
+ * string onto the end of its key pool, growing either one when it is full.
+ * Nodes in an RBT are always red when first inserted. Growing the node
+ * array may move it, so no pointers into it can be held across this call.
+ *
+ * @return The index of a new leaf node holding a copy of the string.
+ */
+
+static node tree_node_new(tree t, struct tree_key *k, int freq) {
+    node x;
+    int i;
+    if ((unsigned int)t->size + 1 == t->capacity) {
+        if (t->capacity > UINT_MAX / 2) {
+            fprintf(stderr, "Too many words for the tree\n");
+            exit(EXIT_FAILURE);
+        }
+        t->nodes = tree_grow(t, t->nodes, t->capacity * sizeof t->nodes[0],
+                             2 * t->capacity * sizeof t->nodes[0]);
+        TREE_BARRIER();
+        t->capacity *= 2;
+    }
+    while (t->keys_len + k->len + 1 > t->keys_size) {
+        if (t->keys_size > UINT_MAX / 2) {
+            fprintf(stderr, "Too many words for the tree\n");
+            exit(EXIT_FAILURE);
+        }
+        t->keys = tree_grow(t, t->keys, t->keys_size, 2 * t->keys_size);
+        TREE_BARRIER();
+        t->keys_size *= 2;
+    }
+    x = ++t->size;
+    for (i = 0; i < TREE_PREFIX_WORDS; i++) {
+        NODE(t, x).prefix[i] = k->prefix[i];
+    }
+    NODE(t, x).key = t->keys_len;
+    memcpy(t->keys + t->keys_len, k->str, k->len + 1);
+    t->keys_len += k->len + 1;
+    NODE(t, x).left = NIL;
+    NODE(t, x).right = NIL;
+    NODE(t, x).frequency = freq;
+    NODE(t, x).count = 1;
+    NODE(t, x).total = freq;
+    NODE(t, x).info = k->len << 1;
+    SET_COLOUR(t, x, (t->type == RBT) ? RED : BLACK);
+    return x;
+}
+
+/**
+ * Function: tree_own()
+ * @param: tree t
+ * Procedure: Replaces the node array, key pool and slot table of t with
+ * copies in memory of its own, with room to grow. The arrays it had are
+ * left alone.
+ */
+
+static void tree_own(tree t) {
+    struct tree_node *nodes;
+    struct tree_slot *slots;
+    char *keys;
+
+    t->capacity = 2 * (t->size + 1);
+    nodes = emalloc(t->capacity * sizeof nodes[0]);
+    memcpy(nodes, t->nodes, (t->size + 1) * sizeof nodes[0]);
+    t->keys_size = 2 * t->keys_len + 1;
+    keys = emalloc(t->keys_size);
+    memcpy(keys, t->keys, t->keys_len);
+    if (t->type == HASH) {
+        slots = emalloc((t->slot_mask + 1) * sizeof slots[0]);
+        memcpy(slots, t->slots, (t->slot_mask + 1) * sizeof slots[0]);
+        t->slots = slots;
+    }
+    t->nodes = nodes;
+    t->keys = keys;
+}
+
+/**
+ * Function: tree_thaw()
+ * @param: tree t
+ * Procedure: A tree loaded by tree_load() lives in a read-only mapping of
+ * its snapshot file. Before such a tree is changed its arrays are copied
+ * by tree_own(), and the mapping is released.
+ */
+
+static void tree_thaw(tree t) {
+    tree_own(t);
+    munmap(t->map, t->map_len);
+    t->map = NULL;
+    t->map_len = 0;
+}
+
+/**
+ * Function: key_hash()
+ * @param: struct tree_key *k
+ * @return the 32-bit FNV-1a hash of the key's string.
+ */
+
+static unsigned int key_hash(struct tree_key *k) {
+    const unsigned char *s = (const unsigned char *)k->str;
+    unsigned int h = 2166136261u;
+    while (*s != '\0') {
+        h = (h ^ *s++) * 16777619u;
+    }
+    return h & 0xFFFFFFFFu;
+}
+
+/**
+ * Function: hash_find()
+ * @param: tree t, struct tree_key *k, unsigned int h
+ * The t variable is a HASH, k is the key to look for and h is its hash.
+ *
+ * Procedure: Probes the slot table linearly from the slot the hash selects
+ * until it finds the key or an empty slot.
+ *
+ * @return the slot holding the key, or the empty slot where it belongs.
+ */
+
+static struct tree_slot *hash_find(tree t, struct tree_key *k, unsigned int h) {
+    unsigned int i = h & t->slot_mask;
+    STATS_ADD(STAT_HASH_PROBES, 1);
+    while (t->slots[i].x != NIL) {
+        if (t->slots[i].hash == h && key_cmp(t, k, t->slots[i].x) == 0) {
+            break;
+        }
+        i = (i + 1) & t->slot_mask;
+        STATS_ADD(STAT_HASH_PROBES, 1);
+    }
+    return &t->slots[i];
+}
+
+/**
+ * Function: hash_grow()
+ * @param: tree t
+ * Procedure: Doubles the size of a HASH's slot table, placing every node
+ * again using the hashes stored in the old slots.
+ */
+
+static void hash_grow(tree t) {
+    struct tree_slot *old = t->slots;
+    unsigned int size = t->slot_mask + 1;
+    unsigned int i, j;
+    if (size > UINT_MAX / 2 / sizeof t->slots[0]) {
+        fprintf(stderr, "Too many words for the tree\n");
+        exit(EXIT_FAILURE);
+    }
+    t->slots = emalloc(2 * size * sizeof t->slots[0]);
+    memset(t->slots, 0, 2 * size * sizeof t->slots[0]);
+    TREE_BARRIER();
+    t->slot_mask = 2 * size - 1;
+    for (i = 0; i < size; i++) {
+        if (old[i].x != NIL) {
+            j = old[i].hash & t->slot_mask;
+            while (t->slots[j].x != NIL) {
+                j = (j + 1) & t->slot_mask;
+            }
+            t->slots[j] = old[i];
+        }
+    }
+    tree_retire(t, old);
+}
+
+/**
+ * Function: hash_add()
+ * @param: tree t, struct tree_key *k, int freq
+ * Procedure: Adds freq to the frequency of the key in a HASH, first adding
+ * a new node for it if it isn't there yet.
+ */
+
+static void hash_add(tree t, struct tree_key *k, int freq) {
+    unsigned int h = key_hash(k);
+    struct tree_slot *slot = hash_find(t, k, h);
+    if (slot->x != NIL) {
+        NODE(t, slot->x).frequency += freq;
+        return;
+    }
+    slot->hash = h;
+    slot->x = tree_node_new(t, k, freq);
+    if ((unsigned int)t->size > t->slot_mask / 2) {
+        hash_grow(t);
+    }
+}
+
+/**
+ * Function: path_push()
+ * @param: node *path, int *depth, node x
+ * Procedure: Records x as the next node on the path down an RBT. A real RBT
+ * never gets as deep as TREE_MAX_PATH, so one that does has been corrupted,
+ * and since the fixups would then rotate the wrong nodes the program stops.
+ */
+
+static void path_push(node *path, int *depth, node x) {
+    if (*depth >= TREE_MAX_PATH) {
+        fprintf(stderr, "The RBT is too deep, it must be corrupt\n");
+        exit(EXIT_FAILURE);
+    }
+    path[(*depth)++] = x;
+}
+
+/**
+ * Function: tree_adjust()
+ * @param: tree t, struct tree_key *k, int count, int total
+ * Procedure: Walks down from the root of a BST or an RBT to the node with
+ * the key k, adding count and total to the count and total of every node
+ * on the way, not including that node itself. The key must be in the tree.
+ */
+
+static void tree_adjust(tree t, struct tree_key *k, int count, int total) {
+    node x = t->root;
+    int s;
+    while ((s = key_cmp(t, k, x)) != 0) {
+        NODE(t, x).count += count;
+        NODE(t, x).total += total;
+        x = (s < 0) ? LEFT(t, x) : RIGHT(t, x);
+    }
+}
+
+/**
+ * Function: tree_add()
+ * @param: tree t, char *str, int freq
+ * The t variable is a tree object where the strings are being inserted to.
+ * The *str pointer contains the string being inserted into that tree.
+ * The freq variable is how many occurrences of the string are being added.
+ *
+ * Procedure:
+ * This function is responsible for inserting strings into our tree object.
+ * It walks down from the root comparing the string against each key only
+ * once, and when it falls off the bottom of the tree a new node is linked
+ * in at that point.
+ *
+ *
+ * Every node passed on the way down is remembered in a path array. If the
+ * tree is an RBT then the new red node may break the RBT properties, so
+ * tree_fix() is then applied to each ancestor, from the parent back up
+ * towards the root, stopping as soon as a fixed subtree has a black root
+ * since no violation can be passed any further up from there.
+ *
+ *
+ * The root of an RBT is always coloured black once the fixups are done.
+ *
+ * If we are trying to insert a string that is already in the tree then we
+ * will add freq to its frequency variable.
+ *
+ * The total of every node passed on the way down has freq added to it.
+ * If a new node was added then every node above it also has its count
+ * increased by one, using the path, before any fixups rotate the tree. A
+ * BST can be deeper than the path holds, and then tree_adjust() walks down
+ * again to the new node instead. An RBT never can, see path_push().
+ *
+ * Both cases loop rather than recurse, so a BST built from sorted input can
+ * not overflow the stack.
+ *
+ * A HASH is handed over to hash_add() instead. A tree loaded from a
+ * snapshot is thawed first.
+ */
+
+static void tree_add(tree t, char *str, int freq) {
+    node path[TREE_MAX_PATH];
+    struct tree_key k;
+    node x = t->root;
+    node parent = NIL;
+    node fixed;
+    int depth = 0;
+    int deep = 0;
+    int s = 0;
+    int i;
+
+    if (t->map != NULL) {
+        tree_thaw(t);
+    }
+    STATS_ADD(STAT_INSERTS, 1);
+    key_init(&k, str);
+    if (t->type == HASH) {
+        hash_add(t, &k, freq);
+        return;
+    }
+    while (x != NIL) {
+        NODE(t, x).total += freq;
+        STATS_ADD(STAT_INSERT_COMPARES, 1);
+        s = key_cmp(t, &k, x);
+        if (s == 0) {
+            NODE(t, x).frequency += freq;
+            return;
+        }
+        if (depth < TREE_MAX_PATH || t->type == RBT) {
+            path_push(path, &depth, x);
+        } else {
+            deep = 1;
+        }
+        parent = x;
+        x = (s < 0) ? LEFT(t, x) : RIGHT(t, x);
+    }
+    x = tree_node_new(t, &k, freq);
+    if (parent == NIL) {
+        t->root = x;
+    } else if (s < 0) {
+        LEFT(t, parent) = x;
+    } else {
+        RIGHT(t, parent) = x;
+    }
+    if (deep) {
+        tree_adjust(t, &k, 1, 0);
+    } else {
+        for (i = 0; i < depth; i++) {
+            NODE(t, path[i]).count++;
+        }
+    }
+
+    if (t->type != RBT) {
+        return;
+    }
+    while (--depth >= 0) {
+        fixed = tree_fix(t, path[depth]);
+        if (depth == 0) {
+            t->root = fixed;
+        } else if (LEFT(t, path[depth - 1]) == path[depth]) {
+            LEFT(t, path[depth - 1]) = fixed;
+        } else {
+            RIGHT(t, path[depth - 1]) = fixed;
+        }
+        if (IS_BLACK(t, fixed)) {
+            break;
+        }
+    }
+    SET_COLOUR(t, t->root, BLACK);
+}
+
+/**
+ * Function: tree_unfreeze()
+ * @param: tree t
+ * Procedure: Drops the static B+ tree made by tree_freeze(), if there is
+ * one, so that the tree can be changed.
+ */
+
+static void tree_unfreeze(tree t) {
+    if (t->frozen != NULL) {
+        free(t->frozen->block);
+        free(t->frozen->refs);
+        free(t->frozen);
+        t->frozen = NULL;
+    }
+}
+
+/**
+ * Function: frozen_set()
+ * @param: tree t, unsigned int i, node x
+ * Procedure: Makes key i of the frozen tree that of node x, or an unused
+ * key if x is NIL.
+ */
+
+static void frozen_set(tree t, unsigned int i, node x) {
+    struct tree_frozen *f = t->frozen;
+    f->refs[i] = x;
+    f->first[i] = ((x == NIL) ? 0xFFFFFFFFu : NODE(t, x).prefix[0]) ^ 0x80000000u;
+    f->second[i] = (x == NIL) ? 0xFFFFFFFFu : NODE(t, x).prefix[1];
+}
+
+/**
+ * Function: tree_freeze()
+ * @param: tree t
+ * The t variable is a BST or RBT which won't be changed for a while.
+ * Procedure: Builds the static B+ tree described at struct tree_frozen,
+ * which tree_search() and tree_frequency() then use instead of walking
+ * the nodes. A search of an RBT of a couple of million words visits some
+ * twenty nodes scattered through memory, while a search of the B+ tree
+ * looks at one cache line on each of its five or six levels. A BST made
+ * degenerate by sorted input is searched in the same few steps. The next
+ * change to the tree drops the B+ tree again. A HASH, an empty tree and a
+ * shared tree, see tree_share(), are left as they are.
+ */
+
+void tree_freeze(tree t) {
+    struct tree_frozen *f;
+    unsigned int blocks[FROZEN_MAX_LEVELS];
+    unsigned int n = t->size, total = 0, i, j, c, child;
+    node *sorted, *first, x;
+    int size = TREE_MAX_PATH, depth = 0, h;
+    node *stack;
+
+    if (t->type == HASH || t->sync != NULL || n == 0) {
+        return;
+    }
+    tree_unfreeze(t);
+    sorted = emalloc(n * sizeof sorted[0]);
+    stack = emalloc(size * sizeof stack[0]);
+    for (i = 0, x = t->root; x != NIL || depth > 0; x = RIGHT(t, x)) {
+        for (; x != NIL; x = LEFT(t, x)) {
+            if (depth == size) {
+                size *= 2;
+                stack = erealloc(stack, size * sizeof stack[0]);
+            }
+            stack[depth++] = x;
+        }
+        x = stack[--depth];
+        sorted[i++] = x;
+    }
+    free(stack);
+
+    f = t->frozen = emalloc(sizeof *f);
+    blocks[0] = (n + FROZEN_B - 1) / FROZEN_B;
+    for (h = 0; blocks[h] > 1; h++) {
+        blocks[h + 1] = (blocks[h] + FROZEN_B) / (FROZEN_B + 1);
+    }
+    f->levels = h + 1;
+    for (h = 0; h < f->levels; h++) {
+        f->start[h] = total;
+        total += blocks[h];
+    }
+    f->block = emalloc(2 * total * FROZEN_B * sizeof f->first[0] + 64);
+    f->first = (unsigned int *)((char *)f->block + (64 - (size_t)f->block % 64) % 64);
+    f->second = f->first + total * FROZEN_B;
+    f->refs = emalloc(total * FROZEN_B * sizeof f->refs[0]);
+
+    /* first[j] is the smallest key under block j of the level being built
+       on. */
+    first = emalloc(blocks[0] * sizeof first[0]);
+    for (i = 0; i < blocks[0] * FROZEN_B; i++) {
+        frozen_set(t, i, (i < n) ? sorted[i] : NIL);
+    }
+    for (j = 0; j < blocks[0]; j++) {
+        first[j] = sorted[j * FROZEN_B];
+    }
+    for (h = 1; h < f->levels; h++) {
+        for (j = 0; j < blocks[h]; j++) {
+            for (c = 1; c <= FROZEN_B; c++) {
+                child = j * (FROZEN_B + 1) + c;
+                frozen_set(t, (f->start[h] + j) * FROZEN_B + c - 1,
+                           (child < blocks[h - 1]) ? first[child] : NIL);
+            }
+            first[j] = first[j * (FROZEN_B + 1)];
+        }
+    }
+    free(first);
+    free(sorted);
+}
+
+/**
+ * Function: frozen_scan()
+ * @param: const unsigned int *first, unsigned int word, unsigned int *less,
+ * unsigned int *equal
+ * Procedure: Compares word with the FROZEN_B first words of a block,
+ * setting bit i of *less if first word i is smaller and bit i of *equal if
+ * it is the same.
+ */
+
+static void frozen_scan(const unsigned int *first, unsigned int word,
+                        unsigned int *less, unsigned int *equal) {
+#ifdef FROZEN_SIMD
+    __m128i w = _mm_set1_epi32((int)(word ^ 0x80000000u));
+    __m128i v;
+    unsigned int l = 0, e = 0;
+    int i;
+    for (i = 0; i < FROZEN_B / 4; i++) {
+        v = _mm_load_si128((const __m128i *)first + i);
+        l |= (unsigned int)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(v, w))) << (4 * i);
+        e |= (unsigned int)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, w))) << (4 * i);
+    }
+    *less = l;
+    *equal = e;
+#else
+    unsigned int l = 0, e = 0, f;
+    int i;
+    for (i = 0; i < FROZEN_B; i++) {
+        f = first[i] ^ 0x80000000u;
+        l |= (unsigned int)(f < word) << i;
+        e |= (unsigned int)(f == word) << i;
+    }
+    *less = l;
+    *equal = e;
+#endif
+}
+
+/**
+ * Function: frozen_find()
+ * @param: tree t, struct tree_key *k
+ * Procedure: Searches a frozen tree's B+ tree for k, from the one block of
+ * its top level down to level 0. In each block the keys whose first words
+ * are smaller than k's come first, and only the few whose first words are
+ * the same as k's need a closer look.
+ * @return the node holding k, or NIL if there is none.
+ */
+
+static node frozen_find(tree t, struct tree_key *k) {
+    struct tree_frozen *f = t->frozen;
+    unsigned int j = 0, c, i, base, less, equal;
+    node x;
+    int h, s;
+
+    for (h = f->levels - 1; h >= 0; h--) {
+        STATS_ADD(STAT_SEARCH_COMPARES, 1);
+        base = (f->start[h] + j) * FROZEN_B;
+        frozen_scan(f->first + base, k->prefix[0], &less, &equal);
+        for (c = 0; less & (1u << c); c++) {
+        }
+        for (i = c; i < FROZEN_B && (equal & (1u << i)); i++) {
+            x = f->refs[base + i];
+            if (x == NIL || f->second[base + i] > k->prefix[1]) {
+                break;
+            }
+            if (f->second[base + i] == k->prefix[1]) {
+                s = key_cmp(t, k, x);
+                if (s < 0) {
+                    break;
+                } else if (s == 0 && h == 0) {
+                    return x;
+                }
+            }
+        }
+        if (h == 0) {
+            return NIL;
+        }
+        j = j * (FROZEN_B + 1) + i;
+    }
+    return NIL;
+}
+
+/**
+ * Function: tree_write_begin()
+ * @param: tree t
+ * Procedure: Every public function which changes a tree calls this
+ * first and tree_write_end() afterwards. A frozen tree is unfrozen, see
+ * tree_freeze(). For a shared tree they take its lock and make its version
+ * odd for the length of the change, see struct tree_sync.
+ */
+
+static void tree_write_begin(tree t) {
+    tree_unfreeze(t);
+    if (t->sync != NULL) {
+        pthread_mutex_lock(&t->sync->lock);
+        t->sync->version++;
+        TREE_BARRIER();
+    }
+}
+
+static void tree_write_end(tree t) {
+    if (t->sync != NULL) {
+        TREE_BARRIER();
+        t->sync->version++;
+        pthread_mutex_unlock(&t->sync->lock);
+    }
+}
+
+/**
+ * Function: tree_insert()
+ * @param: tree t, char *str
+ * The t variable is a tree object where the strings are being inserted to.
+ * The *str pointer contains the string being inserted into that tree.
+ *
+ * Procedure: Adds a single occurrence of the string to the tree, see
+ * tree_add().
+ */
+
+void tree_insert(tree t, char *str) {
+    tree_write_begin(t);
+    tree_add(t, str, 1);
+    tree_write_end(t);
+}
+
+/**
+ * Function: tree_copy()
+ * @param: tree t
+ * The tree to copy, which isn't changed.
+ * Procedure: Every node and key lives in a few arrays, so the copy is made
+ * by copying those rather than inserting each word again, and has exactly
+ * the same shape as t.
+ * @return a new tree holding the same words as t.
+ */
+
+tree tree_copy(tree t) {
+    tree result = emalloc(sizeof *result);
+    *result = *t;
+    result->map = NULL;
+    result->map_len = 0;
+    result->sync = NULL;
+    result->frozen = NULL;
+    tree_own(result);
+    return result;
+}
+
+/**
+ * Function: tree_share()
+ * @param: tree t
+ * Procedure: Makes t safe to change from any number of threads while
+ * others search it. Changes made by tree_insert(), tree_merge(),
+ * tree_delete() and tree_decrement() are made one at a time under a lock,
+ * while tree_search() and tree_frequency() carry on without it, see struct
+ * tree_sync. Any other function still needs t to be left alone while it
+ * runs. A tree loaded from a snapshot is first copied into memory of its
+ * own, since changing it would otherwise unmap the snapshot, and a frozen
+ * tree is unfrozen, see tree_freeze().
+ */
+
+void tree_share(tree t) {
+    struct tree_sync *s;
+    if (t->sync != NULL) {
+        return;
+    }
+    tree_unfreeze(t);
+    if (t->map != NULL) {
+        tree_thaw(t);
+    }
+    memset(t->keys + t->keys_len, 0, t->keys_size - t->keys_len);
+    s = emalloc(sizeof *s);
+    pthread_mutex_init(&s->lock, NULL);
+    s->version = 0;
+    s->retired_size = 16;
+    s->retired = emalloc(s->retired_size * sizeof s->retired[0]);
+    s->n_retired = 0;
+    t->sync = s;
+}
+
+/**
+ * Function: tree_merge()
+ * @param: tree dest, tree src
+ * The dest variable is the tree which the words are merged into.
+ * The src variable is the tree whose words are merged, it is not changed.
+ *
+ * Procedure: Goes through the nodes of src in the order they were
+ * inserted, adding each key to dest along with its frequency, so the
+ * frequencies of words found in both trees are summed. Visiting src in
+ * insertion order means a BST merged into an empty BST keeps its shape.
+ */
+
+void tree_merge(tree dest, tree src) {
+    node x;
+    tree_write_begin(dest);
+    for (x = 1; x <= (node)src->size; x++) {
+        tree_add(dest, KEY(src, x), NODE(src, x).frequency);
+    }
+    tree_write_end(dest);
+}
+
+/**
+ * A word and its frequency, used where the words of a tree are gathered
+ * up and sorted rather than visited in place.
+ */
+
+struct tree_entry {
+    char *key;
+    int frequency;
+};
+
+static int entry_cmp(const void *a, const void *b) {
+    return strcmp(((const struct tree_entry *)a)->key,
+                  ((const struct tree_entry *)b)->key);
+}
+
+/**
+ * Function: tree_link()
+ * @param: tree t, node lo, node hi, int depth, int red_depth
+ * The nodes lo to hi of t hold keys in sorted order and are not yet linked.
+ * Procedure: Makes the middle node the root of the subtree and links the
+ * two halves either side of it below it in the same way, then works out
+ * its count and total. Each subtree
+ * is then as near to the same size as its sibling as can be, so every
+ * NIL child is at one of two depths. In an RBT the nodes at red_depth,
+ * the deepest level when it is not full, are coloured red and every other
+ * node black, which gives every path the same number of black nodes.
+ * @return the root of the linked subtree, or NIL if lo > hi.
+ */
+
+static node tree_link(tree t, node lo, node hi, int depth, int red_depth) {
+    node mid;
+    if (lo > hi) {
+        return NIL;
+    }
+    mid = lo + (hi - lo) / 2;
+    LEFT(t, mid) = tree_link(t, lo, mid - 1, depth + 1, red_depth);
+    RIGHT(t, mid) = tree_link(t, mid + 1, hi, depth + 1, red_depth);
+    if (t->type == RBT) {
+        SET_COLOUR(t, mid, (depth == red_depth) ? RED : BLACK);
+    }
+    tree_update(t, mid);
+    return mid;
+}
+
+/**
+ * Function: tree_build()
+ * @param: tree_t type, char **words, int n
+ * The type variable is the kind of tree to build, and words holds the n
+ * words to put in it, in any order and with repeats. The words are copied
+ * into the tree, so the array can be freed afterwards.
+ *
+ * Procedure: Builds a tree of the words in one go, rather than by
+ * inserting them one at a time. The words are checked to see if they are
+ * already sorted, as a word list often is, and if not they are counted in
+ * a HASH and its distinct words sorted. Each distinct word is then given
+ * a node in sorted order with its count as the frequency, and the nodes
+ * are linked into a perfectly balanced tree by tree_link(), so a BST has
+ * the smallest depth possible and an RBT needs no rotations. A HASH is
+ * just filled with the counted words.
+ *
+ * @return a new tree holding the words.
+ */
+
+tree tree_build(tree_t type, char **words, int n) {
+    struct tree_entry *entries;
+    struct tree_key k;
+    tree counts = NULL;
+    tree t = tree_new(type);
+    int sorted = 1;
+    int count = 0;
+    int i, levels;
+
+    for (i = 1; i < n && sorted; i++) {
+        sorted = strcmp(words[i - 1], words[i]) <= 0;
+    }
+    if (sorted) {
+        entries = emalloc((n + 1) * sizeof entries[0]);
+        for (i = 0; i < n; i++) {
+            if (count > 0 && strcmp(entries[count - 1].key, words[i]) == 0) {
+                entries[count - 1].frequency++;
+            } else {
+                entries[count].key = words[i];
+                entries[count].frequency = 1;
+                count++;
+            }
+        }
+    } else {
+        counts = tree_new(HASH);
+        for (i = 0; i < n; i++) {
+            key_init(&k, words[i]);
+            hash_add(counts, &k, 1);
+        }
+        count = counts->size;
+        entries = emalloc((count + 1) * sizeof entries[0]);
+        for (i = 0; i < count; i++) {
+            entries[i].key = KEY(counts, i + 1);
+            entries[i].frequency = NODE(counts, i + 1).frequency;
+        }
+        if (type != HASH) {
+            qsort(entries, count, sizeof entries[0], entry_cmp);
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        key_init(&k, entries[i].key);
+        if (type == HASH) {
+            hash_add(t, &k, entries[i].frequency);
+        } else {
+            tree_node_new(t, &k, entries[i].frequency);
+        }
+    }
+    if (type != HASH) {
+        for (levels = 0; (1UL << levels) - 1 < (unsigned long)count; levels++) {
+        }
+        t->root = tree_link(t, 1, count, 0,
+                            ((1UL << levels) - 1 == (unsigned long)count) ? -1 : levels - 1);
+    }
+    free(entries);
+    tree_free(counts);
+    return t;
+}
+
+/**
+ * Function: left_rotate()
+ * @param: tree t, node x
+ * The t variable is a data structure variable of either a BST or an RBT,
+ * and x is the root of the subtree to rotate.
+ * Output: 
+ * A tree data structure, either an RBT or a BST.
+ * Procedure: This method left rotates the tree data structure. The new
+ * root of the subtree takes over the count and total of the old one, which
+ * is then worked out again from its new children.
+ * @return: A node rearrangement modified version of the input tree data
+ * structure. 
+ */
+
+static node left_rotate(tree t, node x) {
+    node temp;
+    STATS_ADD(STAT_ROTATIONS, 1);
+    temp = x;
+    x = RIGHT(t, x);
+    RIGHT(t, temp) = LEFT(t, x);
+    LEFT(t, x) = temp;
+    NODE(t, x).count = NODE(t, temp).count;
+    NODE(t, x).total = NODE(t, temp).total;
+    tree_update(t, temp);
+    return x;
+}
+
+/**
+ * Function: right_rotate()
+ * @param: tree t, node x
+ * The t variable is a data structure variable of either a BST or an RBT,
+ * and x is the root of the subtree to rotate.
+ * Output: 
+ * A tree data structure, either an RBT or a BST.
+ * Procedure: This method right rotates the tree data structure, keeping
+ * the counts and totals right in the same way as left_rotate().
+ * @return: A node rearrangement modified version of the input tree data
+ * structure. 
+ */
+
+static node right_rotate(tree t, node x) {
+    node temp; 
+    STATS_ADD(STAT_ROTATIONS, 1);
+    temp = x; 
+    x = LEFT(t, x); 
+    LEFT(t, temp) = RIGHT(t, x);
+    RIGHT(t, x) = temp;
+    NODE(t, x).count = NODE(t, temp).count;
+    NODE(t, x).total = NODE(t, temp).total;
+    tree_update(t, temp);
+    return x;
+}
+
+/**
+ * Function: tree_search()
+ * @param: tree t
+ * This is a data structure variable of either a BST or an RBT.
+ * @param: str* 
+ * The variable *str is a pointer to the char value passed as a parameter
+ * for the data structure traversal. 
+ * Output: an int indicating whether the string was found.
+ * Procedure: 
+ * The tree_search() method walks down the input tree data structure from the
+ * root, comparing the input string against the key of each node exactly
+ * once, see key_cmp(). If the keys match the function returns 1. If the
+ * input string is smaller than the node's key the search carries on in the
+ * left subtree, otherwise it carries on in the right subtree. Reaching an
+ * empty sub-tree means the string is not present and the function returns 0.
+ * 
+ * A HASH is searched by probing its slot table instead. A shared tree, see
+ * tree_share(), is searched without taking its lock.
+ *
+ * @return 1 if str is stored in the tree, 0 otherwise.
+ */
+static node tree_find(tree t, char *str) {
+    struct tree_key k;
+    node x = t->root;
+    int s;
+    STATS_ADD(STAT_SEARCHES, 1);
+    key_init(&k, str);
+    if (t->type == HASH) {
+        return hash_find(t, &k, key_hash(&k))->x;
+    }
+    if (t->frozen != NULL) {
+        return frozen_find(t, &k);
+    }
+    while (x != NIL) {
+        STATS_ADD(STAT_SEARCH_COMPARES, 1);
+        s = key_cmp(t, &k, x);
+        if (s == 0) {
+            return x;
+        }
+        x = (s < 0) ? LEFT(t, x) : RIGHT(t, x);
+    }
+    return NIL;
+}
+
+#ifdef TREE_OPTIMISTIC
+/**
+ * Function: key_cmp_copy()
+ * @param: struct tree_key *k, struct tree_node *n, const char *keys,
+ * size_t keys_size, int *torn
+ * Procedure: Compares a key as key_cmp() does, against a copy n of a node
+ * taken from a shared tree while it may be changing. Its key is looked
+ * for in the key pool keys, which is keys_size bytes long, and *torn is
+ * set if the copy can't be a node of that pool.
+ * @return less than, equal to or greater than zero as for strcmp().
+ */
+
+static int key_cmp_copy(struct tree_key *k, struct tree_node *n, const char *keys,
+                        size_t keys_size, int *torn) {
+    int i;
+    for (i = 0; i < TREE_PREFIX_WORDS; i++) {
+        if (k->prefix[i] != n->prefix[i]) {
+            return (k->prefix[i] < n->prefix[i]) ? -1 : 1;
+        }
+    }
+    if (k->len <= TREE_PREFIX && (n->info >> 1) <= TREE_PREFIX) {
+        return 0;
+    }
+    if ((size_t)n->key + TREE_PREFIX >= keys_size) {
+        *torn = 1;
+        return 0;
+    }
+    return strcmp(k->str + TREE_PREFIX, keys + n->key + TREE_PREFIX);
+}
+
+/**
+ * Function: tree_find_optimistic()
+ * @param: tree t, struct tree_key *k, int *freq
+ * Procedure: Searches a shared tree for k without its lock, see struct
+ * tree_sync. The arrays are read only through copies of their pointers
+ * and sizes, taken in the opposite order to the one tree_node_new() and
+ * hash_grow() publish them in, and every index and offset is checked
+ * against those sizes, so a search which runs into a change never reads
+ * outside the arrays. Its answer is only used if the version is the same
+ * at the end as at the start.
+ * @return 1 and sets *freq to the frequency of k, 0 if it is not stored,
+ * or returns 0 if the search ran into a change.
+ */
+
+static int tree_find_optimistic(tree t, struct tree_key *k, int *freq) {
+    unsigned int version = t->sync->version;
+    struct tree_node *nodes, n;
+    struct tree_slot *slots, slot;
+    unsigned int capacity, mask, h, i, steps;
+    size_t keys_size;
+    char *keys;
+    node x;
+    int s, torn = 0;
+
+    if (version & 1) {
+        return 0;
+    }
+    TREE_BARRIER();
+    capacity = t->capacity;
+    keys_size = t->keys_size;
+    mask = t->slot_mask;
+    TREE_BARRIER();
+    nodes = t->nodes;
+    keys = t->keys;
+    slots = t->slots;
+    n.frequency = 0;
+    if (t->type == HASH) {
+        h = key_hash(k);
+        for (i = h & mask, steps = 0; steps <= mask; i = (i + 1) & mask, steps++) {
+            slot = slots[i];
+            if (slot.x == NIL || slot.x >= capacity) {
+                torn = slot.x != NIL;
+                break;
+            }
+            if (slot.hash == h) {
+                n = nodes[slot.x];
+                if (key_cmp_copy(k, &n, keys, keys_size, &torn) == 0 || torn) {
+                    break;
+                }
+                n.frequency = 0;
+            }
+        }
+    } else {
+        for (x = t->root, steps = 0; x != NIL && !torn; steps++) {
+            if (x >= capacity || steps >= capacity) {
+                torn = 1;
+                break;
+            }
+            n = nodes[x];
+            s = key_cmp_copy(k, &n, keys, keys_size, &torn);
+            if (s == 0) {
+                break;
+            }
+            n.frequency = 0;
+            x = (s < 0) ? n.left : n.right;
+        }
+    }
+    TREE_BARRIER();
+    if (torn || t->sync->version != version) {
+        return 0;
+    }
+    *freq = n.frequency;
+    return 1;
+}
+#endif
+
+/**
+ * Function: tree_lookup()
+ * @param: tree t, char *str
+ * Procedure: Searches the tree for str. A shared tree is searched without
+ * taking its lock, unless a change gets in the way too many times.
+ * @return the frequency of str, 0 if it is not stored in the tree.
+ */
+
+static int tree_lookup(tree t, char *str) {
+    int freq;
+#ifdef TREE_OPTIMISTIC
+    struct tree_key k;
+    int tries;
+#endif
+    if (NULL == t->sync) {
+        return NODE(t, tree_find(t, str)).frequency;
+    }
+#ifdef TREE_OPTIMISTIC
+    key_init(&k, str);
+    for (tries = 0; tries < TREE_OPTIMISTIC_TRIES; tries++) {
+        if (tree_find_optimistic(t, &k, &freq)) {
+            return freq;
+        }
+        sched_yield();
+    }
+#endif
+    pthread_mutex_lock(&t->sync->lock);
+    freq = NODE(t, tree_find(t, str)).frequency;
+    pthread_mutex_unlock(&t->sync->lock);
+    return freq;
+}
+
+int tree_search(tree t, char *str){
+    return tree_lookup(t, str) > 0;
+}
+
+/**
+ * Function: tree_frequency()
+ * @param: tree t, char *str
+ * The t variable is a tree to search and str is the string to look for.
+ * Procedure: Makes the same search as tree_search().
+ * @return the number of times str has been inserted, 0 if it isn't
+ * stored in the tree.
+ */
+
+int tree_frequency(tree t, char *str){
+    return tree_lookup(t, str);
+}
+
+/**
+ * Function: tree_comparisons()
+ * @param: tree t, char *str
+ * The t variable is a tree to search and str is the string to look for.
+ * Procedure: Repeats the walk tree_search() makes for str, counting the
+ * nodes whose keys it compares str against. For a HASH it counts the
+ * slots probed instead.
+ * @return the number of comparisons a search for str makes.
+ */
+
+int tree_comparisons(tree t, char *str){
+    struct tree_key k;
+    struct tree_slot *slot;
+    unsigned int h;
+    node x = t->root;
+    int s, count = 0;
+    key_init(&k, str);
+    if (t->type == HASH) {
+        h = key_hash(&k);
+        slot = hash_find(t, &k, h);
+        return (((unsigned int)(slot - t->slots) - h) & t->slot_mask) + 1;
+    }
+    while (x != NIL) {
+        count++;
+        s = key_cmp(t, &k, x);
+        if (s == 0) {
+            break;
+        }
+        x = (s < 0) ? LEFT(t, x) : RIGHT(t, x);
+    }
+    return count;
+}
+
+/**
+ * Function: tree_depth()
+ * @param: tree t
+ * This is a data structure variable of either a BST or an RBT.
+ * Output: int
+ * Procedure: This function traverses the tree keeping the nodes still to
+ * be visited, and their depths, on a stack of its own rather than
+ * recursing, so a tree made degenerate by sorted input can't overflow the
+ * call stack. The deepest node seen gives the depth of the tree.
+ * For a HASH the depth is the length of the longest probe sequence, which
+ * is the most slots any search has to look at.
+ * @return the maximum tree depth value of either the left or right subtree
+ * data structure. 
+ */
+
+static int node_depth(tree t, node x) {
+    int size = TREE_MAX_PATH;
+    node *stack = emalloc(size * sizeof stack[0]);
+    int *depths = emalloc(size * sizeof depths[0]);
+    int n = 0, d, deepest = 0;
+    if (x == NIL) {
+        free(stack);
+        free(depths);
+        return 0;
+    }
+    stack[n] = x;
+    depths[n++] = 1;
+    while (n > 0) {
+        x = stack[--n];
+        d = depths[n];
+        if (d > deepest) {
+            deepest = d;
+        }
+        if (n + 2 > size) {
+            size *= 2;
+            stack = erealloc(stack, size * sizeof stack[0]);
+            depths = erealloc(depths, size * sizeof depths[0]);
+        }
+        if (RIGHT(t, x) != NIL) {
+            stack[n] = RIGHT(t, x);
+            depths[n++] = d + 1;
+        }
+        if (LEFT(t, x) != NIL) {
+            stack[n] = LEFT(t, x);
+            depths[n++] = d + 1;
+        }
+    }
+    free(stack);
+    free(depths);
+    return deepest;
+}
+
+static int hash_depth(tree t) {
+    unsigned int i, h;
+    int probe, longest = 0;
+    for (i = 0; i <= t->slot_mask; i++) {
+        if (t->slots[i].x != NIL) {
+            h = t->slots[i].hash & t->slot_mask;
+            probe = ((i - h) & t->slot_mask) + 1;
+            if (probe > longest) {
+                longest = probe;
+            }
+        }
+    }
+    return longest;
+}
+
+int tree_depth(tree t) {
+    if (t->type == HASH) {
+        return hash_depth(t);
+    }
+    return node_depth(t, t->root);
+}
+
+/**
+ * Function: tree_size()
+ * @param: tree t
+ * This is a data structure variable of either a BST or an RBT.
+ * Output: int
+ * @return the number of distinct words (nodes) stored in the tree.
+ */
+
+int tree_size(tree t) {
+    return t->size;
+}
+
+/**
+ * Function: tree_memory()
+ * @param: tree t
+ * Output: size_t
+ * Procedure: Adds up the memory given to the tree's arrays, used or not,
+ * so that a caller can keep the tree within a budget. A HASH also counts
+ * the array hash_sorted() gathers its words into to go through them in
+ * order, which it needs on top of the rest. Each array doubles when it
+ * fills up, so one more insert can at most double the total.
+ * @return the number of bytes the tree holds, or the size of the snapshot
+ * for a tree loaded with tree_load() and never changed.
+ */
+
+size_t tree_memory(tree t) {
+    size_t total;
+    if (t->map != NULL) {
+        return t->map_len;
+    }
+    total = sizeof *t + t->capacity * sizeof t->nodes[0] + t->keys_size;
+    if (t->slots != NULL) {
+        total += (t->slot_mask + 1) * sizeof t->slots[0]
+            + t->capacity * sizeof(struct tree_entry);
+    }
+    if (t->frozen != NULL) {
+        total += sizeof *t->frozen + 64 + (t->frozen->start[t->frozen->levels - 1] + 1)
+            * FROZEN_B * (2 * sizeof t->frozen->first[0] + sizeof t->frozen->refs[0]);
+    }
+    return total;
+}
+
+/**
+ * Function: tree_word()
+ * @param: tree t, int i, int *freq
+ * Procedure: Looks up a word by its place in the node array, so every word
+ * can be gone through in O(1) time each without traversing the tree. The
+ * words are in no particular order, and removing a word moves the last one
+ * into its place.
+ * @return the i-th word, 0 <= i < tree_size(t), with its frequency stored
+ * in freq if freq isn't NULL. The word stays valid until the tree is next
+ * changed.
+ */
+
+char *tree_word(tree t, int i, int *freq) {
+    if (freq != NULL) {
+        *freq = NODE(t, i + 1).frequency;
+    }
+    return KEY(t, i + 1);
+}
+
+/**
+ * @param: tree t, node x
+ * The t variable is an RBT and x is the root of one of its subtrees.
+ *
+ * Procedure: This function is responsible for the RBT fixups.
+ * This function goes through a series of if statements to check if there
+ * any RBT violations.
+ *
+ * @return a valid RBT tree.
+ */
+
+static node tree_fix (tree t, node x) {
+    if (IS_RED(t, LEFT(t, x)) && IS_RED(t, LEFT(t, LEFT(t, x)))) {
+        if (IS_RED(t, RIGHT(t, x))) {
+            RECOLOUR(t, x, RED);
+            RECOLOUR(t, LEFT(t, x), BLACK);
+            RECOLOUR(t, RIGHT(t, x), BLACK);
+        } else if(IS_BLACK(t, RIGHT(t, x))) {
+            x = right_rotate(t, x);
+            RECOLOUR(t, x, BLACK);
+            RECOLOUR(t, RIGHT(t, x), RED);
+        }
+    } else if (IS_RED(t, LEFT(t, x)) && IS_RED(t, RIGHT(t, LEFT(t, x)))) {
+        if (IS_RED(t, RIGHT(t, x))) {
+            RECOLOUR(t, x, RED);
+            RECOLOUR(t, LEFT(t, x), BLACK);
+            RECOLOUR(t, RIGHT(t, x), BLACK);
+        } else if (IS_BLACK(t, RIGHT(t, x))) {
+            LEFT(t, x) = left_rotate(t, LEFT(t, x));
+            x = right_rotate(t, x);
+            RECOLOUR(t, x, BLACK);
+            RECOLOUR(t, RIGHT(t, x), RED);
+        }
+    } else if (IS_RED(t, RIGHT(t, x)) && IS_RED(t, LEFT(t, RIGHT(t, x)))) {
+        if (IS_RED(t, LEFT(t, x))) {
+            RECOLOUR(t, x, RED);
+            RECOLOUR(t, LEFT(t, x), BLACK);
+            RECOLOUR(t, RIGHT(t, x), BLACK);
+        } else if (IS_BLACK(t, LEFT(t, x))) {
+            RIGHT(t, x) = right_rotate(t, RIGHT(t, x));
+            x = left_rotate(t, x);
+            RECOLOUR(t, x, BLACK);
+            RECOLOUR(t, LEFT(t, x), RED);
+        }
+    } else if (IS_RED(t, RIGHT(t, x)) && IS_RED(t, RIGHT(t, RIGHT(t, x)))) {
+        if (IS_RED(t, LEFT(t, x))) {
+            RECOLOUR(t, x, RED);
+            RECOLOUR(t, LEFT(t, x), BLACK);
+            RECOLOUR(t, RIGHT(t, x), BLACK);
+        } else if (IS_BLACK(t, LEFT(t, x))) {
+            x = left_rotate(t, x);
+            RECOLOUR(t, x, BLACK);
+            RECOLOUR(t, LEFT(t, x), RED);
+        }
+    }
+    
+    return x;
+}
+
+/**
+ * Function: tree_relink()
+ * @param: tree t, node parent, node old, node x
+ * Procedure: Puts x in the place of old, which must not be NIL, as a child
+ * of parent, or as the root of the tree if parent is NIL.
+ */
+
+static void tree_relink(tree t, node parent, node old, node x) {
+    if (parent == NIL) {
+        t->root = x;
+    } else if (LEFT(t, parent) == old) {
+        LEFT(t, parent) = x;
+    } else {
+        RIGHT(t, parent) = x;
+    }
+}
+
+/**
+ * Function: hash_remove()
+ * @param: tree t, struct tree_slot *slot
+ * Procedure: Empties a slot of a HASH. Any keys further along the same
+ * probe sequence which could have gone in the emptied slot are shifted
+ * back into it, so hash_find() never stops early at a gap.
+ */
+
+static void hash_remove(tree t, struct tree_slot *slot) {
+    unsigned int i = slot - t->slots;
+    unsigned int j = i;
+    unsigned int home;
+    for (;;) {
+        j = (j + 1) & t->slot_mask;
+        if (t->slots[j].x == NIL) {
+            break;
+        }
+        home = t->slots[j].hash & t->slot_mask;
+        if (((j - home) & t->slot_mask) >= ((j - i) & t->slot_mask)) {
+            t->slots[i] = t->slots[j];
+            i = j;
+        }
+    }
+    t->slots[i].x = NIL;
+}
+
+/**
+ * Function: tree_node_free()
+ * @param: tree t, node x
+ * Procedure: Gives back node x, which has already been unlinked from the
+ * tree. The last node of the node array is moved into its place so the
+ * array stays without gaps, and whatever pointed at the last node, found by
+ * looking up its key, is pointed at x instead. The key of x is left in the
+ * key pool, which is only reclaimed when the tree is rebuilt.
+ */
+
+static void tree_node_free(tree t, node x) {
+    node last = t->size--;
+    node parent, child;
+    struct tree_key k;
+    if (x == last) {
+        return;
+    }
+    NODE(t, x) = NODE(t, last);
+    key_init(&k, KEY(t, x));
+    if (t->type == HASH) {
+        hash_find(t, &k, key_hash(&k))->x = x;
+        return;
+    }
+    if (t->root == last) {
+        t->root = x;
+        return;
+    }
+    parent = t->root;
+    for (;;) {
+        child = (key_cmp(t, &k, parent) < 0) ? LEFT(t, parent) : RIGHT(t, parent);
+        if (child == last) {
+            break;
+        }
+        parent = child;
+    }
+    tree_relink(t, parent, last, x);
+}
+
+/**
+ * Function: tree_remove_fix()
+ * @param: tree t, node x, node *path, int depth
+ * The x variable has taken the place of a black node removed from an RBT,
+ * so every path through it is one black node short. The path array holds
+ * the depth ancestors of x from the root down, with room for one more.
+ *
+ * Procedure: If x is red, colouring it black makes up the missing black
+ * node. Otherwise the shortfall is fixed using x's sibling w, which can not
+ * be NIL: a red sibling is rotated above the parent so the sibling becomes
+ * black; a black sibling with two black children is coloured red, which
+ * moves the shortfall up to the parent; and a black sibling with a red
+ * child is rotated, at most twice, so that child makes up the missing
+ * black node and nothing further up needs to change.
+ */
+
+static void tree_remove_fix(tree t, node x, node *path, int depth) {
+    node p, w;
+    while (depth > 0 && IS_BLACK(t, x)) {
+        p = path[depth - 1];
+        if (LEFT(t, p) == x) {
+            w = RIGHT(t, p);
+            if (IS_RED(t, w)) {
+                RECOLOUR(t, w, BLACK);
+                RECOLOUR(t, p, RED);
+                tree_relink(t, (depth > 1) ? path[depth - 2] : NIL, p, left_rotate(t, p));
+                path[depth - 1] = w;
+                path[depth++] = p;
+                w = RIGHT(t, p);
+            }
+            if (IS_BLACK(t, LEFT(t, w)) && IS_BLACK(t, RIGHT(t, w))) {
+                RECOLOUR(t, w, RED);
+                x = p;
+                depth--;
+                continue;
+            }
+            if (IS_BLACK(t, RIGHT(t, w))) {
+                RECOLOUR(t, LEFT(t, w), BLACK);
+                RECOLOUR(t, w, RED);
+                w = right_rotate(t, w);
+                RIGHT(t, p) = w;
+            }
+            RECOLOUR(t, w, COLOUR(t, p));
+            RECOLOUR(t, p, BLACK);
+            RECOLOUR(t, RIGHT(t, w), BLACK);
+            tree_relink(t, (depth > 1) ? path[depth - 2] : NIL, p, left_rotate(t, p));
+        } else {
+            w = LEFT(t, p);
+            if (IS_RED(t, w)) {
+                RECOLOUR(t, w, BLACK);
+                RECOLOUR(t, p, RED);
+                tree_relink(t, (depth > 1) ? path[depth - 2] : NIL, p, right_rotate(t, p));
+                path[depth - 1] = w;
+                path[depth++] = p;
+                w = LEFT(t, p);
+            }
+            if (IS_BLACK(t, LEFT(t, w)) && IS_BLACK(t, RIGHT(t, w))) {
+                RECOLOUR(t, w, RED);
+                x = p;
+                depth--;
+                continue;
+            }
+            if (IS_BLACK(t, LEFT(t, w))) {
+                RECOLOUR(t, RIGHT(t, w), BLACK);
+                RECOLOUR(t, w, RED);
+                w = left_rotate(t, w);
+                LEFT(t, p) = w;
+            }
+            RECOLOUR(t, w, COLOUR(t, p));
+            RECOLOUR(t, p, BLACK);
+            RECOLOUR(t, LEFT(t, w), BLACK);
+            tree_relink(t, (depth > 1) ? path[depth - 2] : NIL, p, right_rotate(t, p));
+        }
+        x = t->root;
+        break;
+    }
+    RECOLOUR(t, x, BLACK);
+}
+
+/**
+ * Function: tree_remove()
+ * @param: tree t, char *str, int freq
+ * The t variable is the tree to remove occurrences of the string from.
+ * The freq variable is how many occurrences to remove, or 0 for all of them.
+ *
+ * Procedure: Finds the string the same way tree_add() does, again keeping
+ * the path down an RBT, which path_push() bounds. A BST needs no path. If it occurs more than freq times its frequency is
+ * just reduced. Otherwise its node is removed: a node with two children
+ * first takes over the key of its successor, the leftmost node of its right
+ * subtree, and the successor is removed instead, so the node actually
+ * unlinked never has more than one child, which takes its place. Removing a
+ * black node from an RBT leaves its paths a black node short, which
+ * tree_remove_fix() puts right. A HASH just empties the key's slot. A tree
+ * loaded from a snapshot is thawed first.
+ *
+ * Before anything is unlinked, the counts and totals above the node are
+ * reduced by what is being removed, with tree_adjust(), as are those of the
+ * nodes between it and its successor when the successor is the one
+ * unlinked. Any rotations made by the fixups then keep them right.
+ *
+ * @return the frequency left, which is 0 if the node was removed, or -1 if
+ * the string is not in the tree.
+ */
+
+static int tree_remove(tree t, char *str, int freq) {
+    node path[TREE_MAX_PATH + 1];
+    struct tree_slot *slot = NULL;
+    struct tree_key k;
+    node z = t->root;
+    node parent = NIL;
+    node x, y, c;
+    int depth = 0;
+    int s;
+
+    if (t->map != NULL) {
+        tree_thaw(t);
+    }
+    key_init(&k, str);
+    if (t->type == HASH) {
+        slot = hash_find(t, &k, key_hash(&k));
+        z = slot->x;
+    } else {
+        while (z != NIL && (s = key_cmp(t, &k, z)) != 0) {
+            if (t->type == RBT) {
+                path_push(path, &depth, z);
+            }
+            parent = z;
+            z = (s < 0) ? LEFT(t, z) : RIGHT(t, z);
+        }
+    }
+    if (z == NIL) {
+        return -1;
+    }
+    if (t->type == HASH) {
+        if (freq > 0 && NODE(t, z).frequency > freq) {
+            NODE(t, z).frequency -= freq;
+            return NODE(t, z).frequency;
+        }
+        hash_remove(t, slot);
+        tree_node_free(t, z);
+        return 0;
+    }
+    if (freq > 0 && NODE(t, z).frequency > freq) {
+        tree_adjust(t, &k, 0, -freq);
+        NODE(t, z).frequency -= freq;
+        NODE(t, z).total -= freq;
+        return NODE(t, z).frequency;
+    }
+
+    tree_adjust(t, &k, -1, -NODE(t, z).frequency);
+    NODE(t, z).count--;
+    NODE(t, z).total -= NODE(t, z).frequency;
+    y = z;
+    if (LEFT(t, z) != NIL && RIGHT(t, z) != NIL) {
+        if (t->type == RBT) {
+            path_push(path, &depth, z);
+        }
+        parent = z;
+        y = RIGHT(t, z);
+        while (LEFT(t, y) != NIL) {
+            if (t->type == RBT) {
+                path_push(path, &depth, y);
+            }
+            parent = y;
+            y = LEFT(t, y);
+        }
+        for (x = RIGHT(t, z); x != y; x = LEFT(t, x)) {
+            NODE(t, x).count--;
+            NODE(t, x).total -= NODE(t, y).frequency;
+        }
+        memcpy(NODE(t, z).prefix, NODE(t, y).prefix, sizeof NODE(t, z).prefix);
+        NODE(t, z).key = NODE(t, y).key;
+        NODE(t, z).frequency = NODE(t, y).frequency;
+        NODE(t, z).info = (NODE(t, y).info & ~1u) | COLOUR(t, z);
+    }
+    c = (LEFT(t, y) != NIL) ? LEFT(t, y) : RIGHT(t, y);
+    tree_relink(t, parent, y, c);
+    if (t->type == RBT && IS_BLACK(t, y)) {
+        tree_remove_fix(t, c, path, depth);
+    }
+    tree_node_free(t, y);
+    return 0;
+}
+
+/**
+ * Function: tree_delete()
+ * @param: tree t, char *str
+ * Procedure: Removes the string from the tree however often it occurs, see
+ * tree_remove().
+ * @return 1 if the string was removed, 0 if it was not in the tree.
+ */
+
+int tree_delete(tree t, char *str) {
+    int result;
+    tree_write_begin(t);
+    result = tree_remove(t, str, 0) == 0;
+    tree_write_end(t);
+    return result;
+}
+
+/**
+ * Function: tree_decrement()
+ * @param: tree t, char *str
+ * Procedure: Removes a single occurrence of the string from the tree, and
+ * the string itself along with its last occurrence, see tree_remove().
+ * @return the frequency of the string left, or -1 if it was not in the tree.
+ */
+
+int tree_decrement(tree t, char *str) {
+    int result;
+    tree_write_begin(t);
+    result = tree_remove(t, str, 1);
+    tree_write_end(t);
+    return result;
+}
+
+/**
+ * Function: tree_preorder()
+ * @param: tree t, void f()
+ * The variable t contains the tree that the function traverses.
+ * A void function is also passed through as an argument, this is typically
+ * a print function to print out the nodes in order of being traversed.
+ *
+ * Procedure: This function traverses the tree by using the
+ * preorder approach, with a stack of the right subtrees still to be
+ * visited in place of recursion. A HASH has no tree to traverse, so its
+ * words are visited in sorted order instead.
  */
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include "tree.h"
-#include "mylib.h"
+static void node_preorder(tree t, node x, void f(int freq, char *str)){
+    int size = TREE_MAX_PATH;
+    node *stack = emalloc(size * sizeof stack[0]);
+    int n = 0;
+    if (x != NIL) {
+        stack[n++] = x;
+    }
+    while (n > 0) {
+        x = stack[--n];
+        f(NODE(t, x).frequency, KEY(t, x));
+        if (n + 2 > size) {
+            size *= 2;
+            stack = erealloc(stack, size * sizeof stack[0]);
+        }
+        if (RIGHT(t, x) != NIL) {
+            stack[n++] = RIGHT(t, x);
+        }
+        if (LEFT(t, x) != NIL) {
+            stack[n++] = LEFT(t, x);
+        }
+    }
+    free(stack);
+}
+
+static void hash_sorted(tree t, char *prefix, void f(int freq, char *str)) {
+    struct tree_entry *entries = emalloc((t->size + 1) * sizeof entries[0]);
+    size_t len = strlen(prefix);
+    int n = 0;
+    node x;
+    for (x = 1; x <= (node)t->size; x++) {
+        if (strncmp(KEY(t, x), prefix, len) == 0) {
+            entries[n].key = KEY(t, x);
+            entries[n].frequency = NODE(t, x).frequency;
+            n++;
+        }
+    }
+    qsort(entries, n, sizeof entries[0], entry_cmp);
+    for (x = 0; x < (node)n; x++) {
+        f(entries[x].frequency, entries[x].key);
+    }
+    free(entries);
+}
+
+void tree_preorder(tree t, void f(int freq, char *str)){
+    if (t->type == HASH) {
+        hash_sorted(t, "", f);
+        return;
+    }
+    node_preorder(t, t->root, f);
+}
 
 /**
- * IS_BLACK & IS_RED indicate the state of tree data structure node colour.
- * These statements evaluate the colour of individual tree data structure
- * nodes, the use of these statements are in the tree_fix() function.
+ * Function: top_before()
+ * @param: tree t, node a, node b
+ * @return non-zero if node a ranks before node b in a top list, which puts
+ * higher frequencies first and equal frequencies in sorted order.
  */
 
-#define IS_BLACK(x) ((NULL == (x)) || (BLACK == (x)->colour))
-#define IS_RED(x) ((NULL != (x)) && (RED == (x)->colour))
+static int top_before(tree t, node a, node b) {
+    if (NODE(t, a).frequency != NODE(t, b).frequency) {
+        return NODE(t, a).frequency > NODE(t, b).frequency;
+    }
+    return strcmp(KEY(t, a), KEY(t, b)) < 0;
+}
+
+/**
+ * Function: top_sift()
+ * @param: tree t, node *heap, int n, int i
+ * Procedure: Moves the node at position i of a heap of n nodes down until
+ * neither of its children ranks after it, so the root of the heap is always
+ * the node ranking last.
+ */
 
-static tree_t tree_type;
+static void top_sift(tree t, node *heap, int n, int i) {
+    node x = heap[i];
+    int c;
+    while ((c = 2 * i + 1) < n) {
+        if (c + 1 < n && top_before(t, heap[c], heap[c + 1])) {
+            c++;
+        }
+        if (!top_before(t, x, heap[c])) {
+            break;
+        }
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = x;
+}
 
-struct tree_node{
-    char *key;
-    tree_colour colour;
-    tree left; 
-    tree right;
-    int frequency;
+/**
+ * The k best nodes found so far by tree_top() or tree_complete(), kept in a
+ * heap with the node ranking last at the root.
+ */
+struct top_list {
+    node *heap;
+    int n;
+    int k;
 };
 
 /**
- * Function: tree_new()
- * @param: int input
- * This is a variable of an int type indicates if the to be created data 
- * structure is a BST or an RBT.
- * Output: 
- * A tree data structure, either an RBT or a BST.
- * Procedure: Allocates memory to the tree data structure; 
- * @return A null tree data structure (nodes or associated key values)
+ * Function: top_offer()
+ * @param: tree t, struct top_list *top, node x
+ * Procedure: Puts node x in the list if it is not yet full, turning the
+ * list into a heap once it fills up. After that a node only goes in if it
+ * ranks before the root of the heap, which it then replaces.
  */
-tree tree_new(int input) { 
-    if (input == 0) { 
-        tree_type = BST;
-    } else if (input == 1) {
-        tree_type = RBT;
+
+static void top_offer(tree t, struct top_list *top, node x) {
+    int i;
+    if (top->n < top->k) {
+        top->heap[top->n++] = x;
+        if (top->n == top->k) {
+            for (i = top->k / 2 - 1; i >= 0; i--) {
+                top_sift(t, top->heap, top->k, i);
+            }
+        }
+    } else if (top_before(t, x, top->heap[0])) {
+        top->heap[0] = x;
+        top_sift(t, top->heap, top->k, 0);
     }
-    return NULL;
 }
 
 /**
- * Function: tree_insert()
- * @param: tree t, char *str
- * The t variable is a tree object where the strings are being inserted to.
- * The *str pointer contains the string being inserted into that tree.
- *
- * Procedure:
- * This function is responsible for inserting strings into our tree object.
- * If the tree object is null then the function will allocate space to
- * hold the string into the tree.
- *
- *
- * If the tree is an RBT then it will assign the colour of that node to red
- * as every node being inserting into an RBT is assign red by default before
- * any RBT fixups occur.
- *
- *
- * If we are trying to insert a string that is already in the tree then we
- * will increment its frequency variable.
- *
- * @return Will return a tree object with the string as a node in the tree.
+ * Function: top_finish()
+ * @param: tree t, struct top_list *top, void f()
+ * Procedure: Sorts the heap in place, so f is called with the frequency and
+ * key of each node in the list most frequent first, then frees it.
  */
 
-tree tree_insert(tree t, char *str) {
-    int s;
-    if(t == NULL) {
-        t = emalloc(sizeof *t);
-        t->key = emalloc((strlen(str)+1) * sizeof t->key[0]);
-        t->right = NULL;
-        t->left = NULL;
-        t->frequency = 1;
-        if (tree_type == RBT) { 
-            t->colour = RED;
-        }
-        strcpy(t->key,str);
-    } else {
-        s = strcmp(str, t->key);
-        if(s == 0) {
-            t->frequency++;
-        } else if(s < 0){  
-            t->left = tree_insert(t->left, str);
-        } else if(s > 0){
-            t->right = tree_insert(t->right,str);
+static void top_finish(tree t, struct top_list *top, void f(int freq, char *str)) {
+    node x;
+    int i;
+    if (top->n < top->k) {
+        for (i = top->n / 2 - 1; i >= 0; i--) {
+            top_sift(t, top->heap, top->n, i);
         }
     }
-    
-    if (tree_type == RBT) {
-        t = tree_fix(t);
-        return t; 
-    } else {
-    return t;
+    for (i = top->n - 1; i > 0; i--) {
+        x = top->heap[0];
+        top->heap[0] = top->heap[i];
+        top->heap[i] = x;
+        top_sift(t, top->heap, i, 0);
     }
+    for (i = 0; i < top->n; i++) {
+        f(NODE(t, top->heap[i]).frequency, KEY(t, top->heap[i]));
+    }
+    free(top->heap);
 }
 
 /**
- * Function: left_rotate()
- * @param: tree t
- * This is a data structure variable of either a BST or an RBT.
- * Output: 
- * A tree data structure, either an RBT or a BST.
- * Procedure: This method left rotates the tree data structure 
- * @return: A node rearrangement modified version of the input tree data
- * structure. 
+ * Function: node_inorder()
+ * @param: tree t, char *prefix, void f(), struct top_list *top
+ * The variable t contains the tree that the function traverses, and f is
+ * called with the frequency and key of each node starting with prefix, or
+ * if top is not NULL each such node is offered to top instead.
+ *
+ * Procedure: Visits the words starting with prefix in sorted order. The
+ * tree is walked with an explicit stack of the nodes still waiting to be
+ * visited, which grows as needed, so a BST as deep as it has words can be
+ * walked without using up the call stack. The stack is first filled on the
+ * way down to the first key not less than the prefix, skipping every
+ * smaller key, and the walk stops at the first key after it which doesn't
+ * start with the prefix, so only the words wanted and the nodes above them
+ * are ever looked at.
  */
 
-static tree left_rotate(tree t) {
-    tree temp;
-    temp = t;
-    t = t->right;
-    temp->right = t->left;
-    t->left = temp;
-    return t;
+static void node_inorder(tree t, char *prefix, void f(int freq, char *str),
+                         struct top_list *top) {
+    struct tree_key k;
+    size_t len = strlen(prefix);
+    int size = TREE_MAX_PATH;
+    node *stack = emalloc(size * sizeof stack[0]);
+    int depth = 0;
+    node x = t->root;
+    int lower = len > 0;
+
+    key_init(&k, prefix);
+    for (;;) {
+        while (x != NIL) {
+            if (lower && key_cmp(t, &k, x) > 0) {
+                x = RIGHT(t, x);
+                continue;
+            }
+            if (depth == size) {
+                size *= 2;
+                stack = erealloc(stack, size * sizeof stack[0]);
+            }
+            stack[depth++] = x;
+            x = LEFT(t, x);
+        }
+        if (depth == 0) {
+            break;
+        }
+        lower = 0;
+        x = stack[--depth];
+        if (strncmp(KEY(t, x), prefix, len) != 0) {
+            break;
+        }
+        if (top != NULL) {
+            top_offer(t, top, x);
+        } else {
+            f(NODE(t, x).frequency, KEY(t, x));
+        }
+        x = RIGHT(t, x);
+    }
+    free(stack);
 }
 
 /**
- * Function: right_rotate()
- * @param: tree t
- * This is a data structure variable of either a BST or an RBT.
- * Output: 
- * A tree data structure, either an RBT or a BST.
- * Procedure: This method right rotates the tree data structure 
- * @return: A node rearrangement modified version of the input tree data
- * structure. 
+ * Function: tree_inorder()
+ * @param: tree t, void f()
+ * The variable t contains the tree that the function traverses, and f is
+ * called with the frequency and key of each node in turn.
+ *
+ * Procedure: Visits every word in sorted order, see node_inorder(). A HASH
+ * is sorted instead.
  */
 
-static tree right_rotate(tree t) {
-    tree temp; 
-    temp = t; 
-    t = t->left; 
-    temp->left = t->right;
-    t->right = temp;
-    return t;
+void tree_inorder(tree t, void f(int freq, char *str)) {
+    tree_prefix(t, "", f);
 }
 
 /**
- * Function: tree_search()
- * @param: tree t
- * This is a data structure variable of either a BST or an RBT.
- * @param: str* 
- * The variable *str is a pointer to the char value passed as a parameter
- * for the data structure traversal. 
- * Output: and int data type to a recursive function call.
- * A tree data structure, either an RBT or a BST.
- * Procedure: 
- * The tree_search() method is used to traverse the input tree data structure
- * and reading input by evaluating key char variable values to the keys strings
- * present within the tree data structures current tree node. There are three
- * cases which can be executed depending on the various if statements. If the
- * if() comparison returns true for any if statement. The if() statement
- * returns a recursive method call for either left or right tree key node left
- * or right subtree traversal. If the traversal search() function encounters
- * a NULL tree or sub-tree it will return 0 as this value is indicative of an
- * untraversable path. If the functions traverses to a node and its key
- * matches the value provided as input the function 
- * returns 1. If the node's key exceeds the character asci character input
- * key we return the result of searching the left subtree. If the key is to 
- * small the method returns the result of searching the right subtree.
- * 
- * @return A recursive tree_search() call to either the left or right subtree
- * of a data structure.
+ * Function: tree_prefix()
+ * @param: tree t, char *prefix, void f()
+ * The variable t contains the tree that the function traverses, and f is
+ * called with the frequency and key of each word starting with prefix.
+ *
+ * Procedure: Visits the words starting with prefix in sorted order, see
+ * node_inorder(). A HASH has to look at every word, then sort the ones
+ * which match.
  */
-int tree_search(tree t, char *str){
-    if (t == NULL) {
-        return 0;
+
+void tree_prefix(tree t, char *prefix, void f(int freq, char *str)) {
+    if (t->type == HASH) {
+        hash_sorted(t, prefix, f);
+        return;
     }
+    node_inorder(t, prefix, f, NULL);
+}
+
+/**
+ * Function: tree_complete()
+ * @param: tree t, char *prefix, int k, void f()
+ * The variable t contains the tree to look in, k is how many words are
+ * wanted, and f is called with the frequency and key of each of them.
+ *
+ * Procedure: Finds the k most frequent words starting with prefix, which
+ * are visited most frequent first, with words of the same frequency in
+ * sorted order. In a BST or an RBT only the words starting with the prefix
+ * are walked, see node_inorder(), while the best k of them are kept in a
+ * heap, so a query takes O(log n + m log k) time for m matching words and
+ * O(k) space. With no prefix, or in a HASH, the node array is scanned from
+ * start to end instead.
+ */
+
+void tree_complete(tree t, char *prefix, int k, void f(int freq, char *str)) {
+    struct top_list top;
+    size_t len = strlen(prefix);
+    node x;
 
-    if (strcmp(str, t->key) == 0) {
-        return 1;
-    } else if (strcmp(str, t->key) < 0) {
-        return tree_search(t->left, str);
+    if (k > t->size) {
+        k = t->size;
+    }
+    if (k <= 0) {
+        return;
+    }
+    top.heap = emalloc(k * sizeof top.heap[0]);
+    top.n = 0;
+    top.k = k;
+    if (t->type == HASH || len == 0) {
+        for (x = 1; x <= (node)t->size; x++) {
+            if (len == 0 || strncmp(KEY(t, x), prefix, len) == 0) {
+                top_offer(t, &top, x);
+            }
+        }
     } else {
-        return tree_search(t->right, str);
+        node_inorder(t, prefix, f, &top);
+    }
+    top_finish(t, &top, f);
+}
+
+/**
+ * Function: tree_top()
+ * @param: tree t, int k, void f()
+ * Procedure: Visits the k most frequent words in the tree, most frequent
+ * first, see tree_complete(). This takes O(n log k) time and O(k) space,
+ * without sorting every word.
+ */
+
+void tree_top(tree t, int k, void f(int freq, char *str)) {
+    tree_complete(t, "", k, f);
+}
+
+/**
+ * Function: tree_below()
+ * @param: tree t, char *str, unsigned int *count, unsigned int *total
+ * Procedure: Finds how many words in the tree sort before str, and their
+ * total frequency. Going down a BST or an RBT, each time the search moves
+ * right every word in the left subtree, and the node itself, are counted
+ * using the left subtree's count and total. A HASH has no order, so every
+ * one of its words is compared instead.
+ */
+
+static void tree_below(tree t, char *str, unsigned int *count, unsigned int *total) {
+    struct tree_key k;
+    node x = t->root;
+    int s;
+
+    *count = 0;
+    *total = 0;
+    if (t->type == HASH) {
+        for (x = 1; x <= (node)t->size; x++) {
+            if (strcmp(KEY(t, x), str) < 0) {
+                *count += 1;
+                *total += NODE(t, x).frequency;
+            }
+        }
+        return;
+    }
+    key_init(&k, str);
+    while (x != NIL) {
+        s = key_cmp(t, &k, x);
+        if (s > 0) {
+            *count += NODE(t, LEFT(t, x)).count + 1;
+            *total += NODE(t, LEFT(t, x)).total + NODE(t, x).frequency;
+        } else if (s == 0) {
+            *count += NODE(t, LEFT(t, x)).count;
+            *total += NODE(t, LEFT(t, x)).total;
+            return;
+        }
+        x = (s < 0) ? LEFT(t, x) : RIGHT(t, x);
     }
 }
 
 /**
- * Function: rbt_insert()
+ * Function: tree_rank()
  * @param: tree t, char *str
- * The t variable is a tree object which should be an RBT type.
- * The *str pointer contains the string value inserted into
- * the tree.
- *
- *
- * Procedure:
- * This function calls the tree_insert() function recursively to insert the
- * strings as nodes in the tree. When it has finished recursively inserting
- * the strings into the string, it would naturally be at the root node at
- * the end of the recursion.
- *
- * We will change that root node to black to make the RBT a valid tree.
- *
- * This function is only called when the tree is an RBT
- *
- * @return a complete tree object with the root node black.
+ * Procedure: Counts the words before str in O(log n) time in an RBT, see
+ * tree_below(). The string doesn't have to be in the tree.
+ * @return the number of distinct words in the tree which sort before str.
  */
 
-tree rbt_insert(tree t, char *str) {
-    t = tree_insert(t, str);
-    t->colour = BLACK;
-    return t;
+int tree_rank(tree t, char *str) {
+    unsigned int count, total;
+    tree_below(t, str, &count, &total);
+    return count;
 }
 
 /**
- * Function: tree_depth()
- * @param: tree t
- * This is a data structure variable of either a BST or an RBT.
- * Output: int
- * Procedure: This function traverses the left and right subtrees of the tree 
- * data structure and using recursive calls to the tree_depth function 
- * increments the total node sum for both the left and right subtrees.
- * Then afterward compares the total values for the depth of the left and right 
- * subtrees returning the maximum int value of either the left or right subtree
- * data structure.
- * @return the maximum tree depth value of either the left or right subtree
- * data structure. 
+ * Function: tree_range_count()
+ * @param: tree t, char *lo, char *hi
+ * Procedure: Counts the words from lo up to but not including hi as the
+ * difference of two ranks, see tree_below().
+ * @return the number of distinct words w in the tree with lo <= w < hi.
  */
 
-int tree_depth(tree t) {
-    int leftDepth, rightDepth;
-    if (t == NULL) {
+int tree_range_count(tree t, char *lo, char *hi) {
+    unsigned int lo_count, hi_count, total;
+    if (strcmp(lo, hi) >= 0) {
         return 0;
     }
-        leftDepth =  tree_depth(t->left);
-        rightDepth = tree_depth(t->right);
-    if (leftDepth > rightDepth) {
-        return leftDepth + 1;
-    } else {
-        return rightDepth + 1;
+    tree_below(t, lo, &lo_count, &total);
+    tree_below(t, hi, &hi_count, &total);
+    return hi_count - lo_count;
+}
+
+/**
+ * Function: tree_range_total()
+ * @param: tree t, char *lo, char *hi
+ * Procedure: Adds up the frequencies of the words from lo up to but not
+ * including hi, in the same way as tree_range_count().
+ * @return the total frequency of the words w in the tree with lo <= w < hi.
+ */
+
+int tree_range_total(tree t, char *lo, char *hi) {
+    unsigned int count, lo_total, hi_total;
+    if (strcmp(lo, hi) >= 0) {
+        return 0;
     }
+    tree_below(t, lo, &count, &lo_total);
+    tree_below(t, hi, &count, &hi_total);
+    return hi_total - lo_total;
 }
 
 /**
- * @param: tree t
- * This is a variable of data structure either a BST or an RBT
- *
- * Procedure: This function is responsible for the RBT fixups.
- * This function goes through a series of if statements to check if there
- * any RBT violations.
- *
- * @return a valid RBT tree.
+ * Function: tree_select()
+ * @param: tree t, int i
+ * Procedure: Finds the word with i words before it. Going down a BST or an
+ * RBT, the count of the left subtree says whether that word is to the left,
+ * is the node itself, or is to the right, in which case the words skipped
+ * are taken off i. A HASH is sorted to find it.
+ * @return the word of rank i, which stays valid until the tree is next
+ * changed, or NULL if i is not between 0 and the number of words - 1.
  */
 
-tree tree_fix (tree t) {
-    if (IS_RED(t->left) && IS_RED(t->left->left)) {
-        if (IS_RED(t->right)) {
-            t->colour = RED;
-            t->left->colour = BLACK;
-            t->right->colour = BLACK;
-        } else if(IS_BLACK(t->right)) {
-            t = right_rotate(t);
-            t->colour = BLACK;
-            t->right->colour = RED;
-        }
-    } else if (IS_RED(t->left) && IS_RED(t->left->right)) {
-        if (IS_RED(t->right)) {
-            t->colour = RED;
-            t->left->colour = BLACK;
-            t->right->colour = BLACK;
-        } else if (IS_BLACK(t->right)) {
-            t->left = left_rotate(t->left);
-            t = right_rotate(t);
-            t->colour = BLACK;
-            t->right->colour = RED;
-        }
-    } else if (IS_RED(t->right) && IS_RED(t->right->left)) {
-        if (IS_RED(t->left)) {
-            t->colour = RED;
-            t->left->colour = BLACK;
-            t->right->colour = BLACK;
-        } else if (IS_BLACK(t->left)) {
-            t->right = right_rotate(t->right);
-            t = left_rotate(t);
-            t->colour = BLACK;
-            t->left->colour = RED;
-        }
-    } else if (IS_RED(t->right) && IS_RED(t->right->right)) {
-        if (IS_RED(t->left)) {
-            t->colour = RED;
-            t->left->colour = BLACK;
-            t->right->colour = BLACK;
-        } else if (IS_BLACK(t->left)) {
-            t = left_rotate(t);
-            t->colour = BLACK;
-            t->left->colour = RED;
+char *tree_select(tree t, int i) {
+    struct tree_entry *entries;
+    unsigned int r = i;
+    node x = t->root;
+    char *word;
+
+    if (i < 0 || i >= t->size) {
+        return NULL;
+    }
+    if (t->type == HASH) {
+        entries = emalloc(t->size * sizeof entries[0]);
+        for (x = 1; x <= (node)t->size; x++) {
+            entries[x - 1].key = KEY(t, x);
+            entries[x - 1].frequency = NODE(t, x).frequency;
+        }
+        qsort(entries, t->size, sizeof entries[0], entry_cmp);
+        word = entries[i].key;
+        free(entries);
+        return word;
+    }
+    for (;;) {
+        if (r < NODE(t, LEFT(t, x)).count) {
+            x = LEFT(t, x);
+        } else if (r == NODE(t, LEFT(t, x)).count) {
+            return KEY(t, x);
+        } else {
+            r -= NODE(t, LEFT(t, x)).count + 1;
+            x = RIGHT(t, x);
         }
     }
-    
-    return t;
 }
 
 /**
- * Function: tree_preorder()
- * @param: tree t, void f()
- * The variable t contains the tree that the function traverses.
- * A void function is also passed through as an argument, this is typically
- * a print function to print out the nodes in order of being traversed.
+ * Writes the DOT description of node x, which looks like
  *
- * Procedure: This function traverses the tree by using the
- * preorder approach.
+ *    "key"[label="{<f0>key:frequency|{<f1>|<f2>}}"color=black];
+ *
+ * @param t the tree being output.
+ * @param x the node to output a DOT description of.
+ * @param colour the colour to draw the node.
+ * @param out the writer to write the DOT output to.
  */
 
-void tree_preorder(tree t, void f(int freq, char *str)){
-    if(t == NULL){
-        return;
-    }
-    f(t->frequency, t->key);
-    tree_preorder(t->left, f);
-    tree_preorder(t->right, f);
+static void dot_node(tree t, node x, const char *colour, writer out) {
+    writer_char(out, '"');
+    writer_str(out, KEY(t, x));
+    writer_str(out, "\"[label=\"{<f0>");
+    writer_str(out, KEY(t, x));
+    writer_char(out, ':');
+    writer_int(out, NODE(t, x).frequency, 0);
+    writer_str(out, "|{<f1>|<f2>}}\"color=");
+    writer_str(out, colour);
+    writer_str(out, "];\n");
+}
+
+/**
+ * Writes the DOT description of an edge from field f1 (left) or f2 (right)
+ * of node x to its child y.
+ */
+
+static void dot_edge(tree t, node x, const char *field, node y, writer out) {
+    writer_char(out, '"');
+    writer_str(out, KEY(t, x));
+    writer_str(out, field);
+    writer_str(out, " -> \"");
+    writer_str(out, KEY(t, y));
+    writer_str(out, "\":f0;\n");
 }
 
 /**
  * Traverses the tree writing a DOT description about connections, and
- * possibly colours, to the given output stream.
+ * possibly colours, to the given writer. Each node is followed by its
+ * left subtree and the edge to it, then its right subtree and the edge to
+ * that. A stack of its own holds the path down to the current node, with
+ * how far each node on it has got, so a degenerate tree can't overflow
+ * the call stack.
  *
- * @param t the tree to output a DOT description of.
- * @param out the stream to write the DOT output to.
+ * @param t the tree being output.
+ * @param x the subtree to output a DOT description of.
+ * @param out the writer to write the DOT output to.
  */
 
-static void tree_output_dot_aux(tree t, FILE *out) {
-    if(t->key != NULL) {
-        fprintf(out, "\"%s\"[label=\"{<f0>%s:%d|{<f1>|<f2>}}\"color=%s];\n",
-                t->key, t->key, t->frequency,
-                (RBT == tree_type && RED == t->colour) ? "red":"black");
-    }
-    if(t->left != NULL) {
-        tree_output_dot_aux(t->left, out);
-        fprintf(out, "\"%s\":f1 -> \"%s\":f0;\n", t->key, t->left->key);
-    }
-    if(t->right != NULL) {
-        tree_output_dot_aux(t->right, out);
-        fprintf(out, "\"%s\":f2 -> \"%s\":f0;\n", t->key, t->right->key);
+static void tree_output_dot_aux(tree t, node x, writer out) {
+    int size = TREE_MAX_PATH;
+    node *stack = emalloc(size * sizeof stack[0]);
+    char *stage = emalloc(size * sizeof stage[0]);
+    int n = 0;
+    node y;
+
+    stack[n] = x;
+    stage[n++] = 0;
+    while (n > 0) {
+        x = stack[n - 1];
+        if (stage[n - 1] == 0) {
+            dot_node(t, x, (RBT == t->type && IS_RED(t, x)) ? "red" : "black", out);
+            y = LEFT(t, x);
+        } else if (stage[n - 1] == 1) {
+            if (LEFT(t, x) != NIL) {
+                dot_edge(t, x, "\":f1", LEFT(t, x), out);
+            }
+            y = RIGHT(t, x);
+        } else {
+            if (RIGHT(t, x) != NIL) {
+                dot_edge(t, x, "\":f2", RIGHT(t, x), out);
+            }
+            n--;
+            continue;
+        }
+        stage[n - 1]++;
+        if (y != NIL) {
+            if (n == size) {
+                size *= 2;
+                stack = erealloc(stack, size * sizeof stack[0]);
+                stage = erealloc(stage, size * sizeof stage[0]);
+            }
+            stack[n] = y;
+            stage[n++] = 0;
+        }
     }
+    free(stack);
+    free(stage);
 }
 
 /**
@@ -362,14 +2483,129 @@ static void tree_output_dot_aux(tree t, FILE *out) {
  *
  * You can also use png, ps, jpg, svg... instead of pdf
  *
+ * A HASH has no edges, so only its nodes are written. The output goes
+ * through a large buffer, see writer_new(), rather than a call to
+ * fprintf() for every node and edge.
+ *
  * @param t the tree to output the DOT description of.
  * @param out the stream to write the DOT description to.
+ * @return 0 if the description was written, EOF if there was a write
+ * error.
+ */
+
+int tree_output_dot(tree t, FILE *out) {
+    writer w = writer_new(out, TREE_WRITER_SIZE);
+    int result;
+    writer_str(w, "digraph tree {\nnode [shape = Mrecord, penwidth = 2];\n");
+    if (t->type == HASH) {
+        node x;
+        for (x = 1; x <= (node)t->size; x++) {
+            dot_node(t, x, "black", w);
+        }
+    } else if (t->root != NIL) {
+        tree_output_dot_aux(t, t->root, w);
+    }
+    writer_str(w, "}\n");
+    result = writer_flush(w);
+    writer_free(w);
+    return result;
+}
+
+/**
+ * Function: tree_valid()
+ * @param: tree t
+ * The t variable is the tree to check, which isn't changed.
+ * Procedure: Checks that every node's prefix and length match its key,
+ * and for a HASH that every node can be found through the slot table and
+ * nothing else is in it. For a BST or an RBT it walks the tree, keeping
+ * its own stack as tree_output_dot_aux() does, checking that the keys are
+ * in sorted order, that every node is reached once, and that each count
+ * and total matches those of the node's children. In an RBT the root must
+ * also be black, no red node may have a red child, and every path down
+ * must pass the same number of black nodes.
+ * @return 1 if the tree is sound, 0 if not.
  */
 
-void tree_output_dot(tree t, FILE *out) {
-    fprintf(out, "digraph tree {\nnode [shape = Mrecord, penwidth = 2];\n");
-    tree_output_dot_aux(t, out);
-    fprintf(out, "}\n");
+int tree_valid(tree t) {
+    struct tree_key k;
+    int size = TREE_MAX_PATH, n = 0, visited = 0, ok = 1, i;
+    int left_black, right_black, *black;
+    node *stack, x, y, l, r;
+    unsigned int occupied = 0;
+    char *stage, *prev = NULL;
+
+    for (x = 1; x <= (node)t->size; x++) {
+        key_init(&k, KEY(t, x));
+        for (i = 0; i < TREE_PREFIX_WORDS; i++) {
+            ok &= k.prefix[i] == NODE(t, x).prefix[i];
+        }
+        ok &= k.len == KEY_LEN(t, x) && NODE(t, x).frequency > 0;
+    }
+    if (t->type == HASH) {
+        for (i = 0; (unsigned int)i <= t->slot_mask; i++) {
+            occupied += t->slots[i].x != NIL;
+        }
+        for (x = 1; x <= (node)t->size; x++) {
+            key_init(&k, KEY(t, x));
+            ok &= hash_find(t, &k, key_hash(&k))->x == x;
+        }
+        return ok && occupied == (unsigned int)t->size;
+    }
+    if (t->root == NIL || NODE(t, NIL).count != 0 || NODE(t, NIL).total != 0) {
+        return ok && t->root == NIL && t->size == 0;
+    }
+    ok &= !(RBT == t->type && IS_RED(t, t->root)) && t->root <= (node)t->size;
+
+    black = emalloc((t->size + 1) * sizeof black[0]);
+    stack = emalloc(size * sizeof stack[0]);
+    stage = emalloc(size * sizeof stage[0]);
+    black[NIL] = 1;
+    stack[n] = t->root;
+    stage[n++] = 0;
+    while (ok && n > 0) {
+        x = stack[n - 1];
+        if (stage[n - 1] == 0) {
+            y = LEFT(t, x);
+        } else if (stage[n - 1] == 1) {
+            ok &= NULL == prev || strcmp(prev, KEY(t, x)) < 0;
+            prev = KEY(t, x);
+            visited++;
+            y = RIGHT(t, x);
+        } else {
+            l = LEFT(t, x);
+            r = RIGHT(t, x);
+            ok &= NODE(t, x).count == NODE(t, l).count + NODE(t, r).count + 1;
+            ok &= NODE(t, x).total == NODE(t, l).total + NODE(t, r).total
+                + (unsigned int)NODE(t, x).frequency;
+            if (RBT == t->type) {
+                left_black = black[l];
+                right_black = black[r];
+                ok &= left_black == right_black;
+                ok &= !(IS_RED(t, x) && (IS_RED(t, l) || IS_RED(t, r)));
+                black[x] = left_black + !IS_RED(t, x);
+            }
+            n--;
+            continue;
+        }
+        stage[n - 1]++;
+        if (y != NIL) {
+            if (y > (node)t->size || n > t->size) {
+                ok = 0;
+                break;
+            }
+            if (n == size) {
+                size *= 2;
+                stack = erealloc(stack, size * sizeof stack[0]);
+                stage = erealloc(stage, size * sizeof stage[0]);
+            }
+            stack[n] = y;
+            stage[n++] = 0;
+        }
+    }
+    free(stack);
+    free(stage);
+    free(black);
+    return ok && visited == t->size;
 }
 
 /**
@@ -378,19 +2614,209 @@ void tree_output_dot(tree t, FILE *out) {
  * This is an instance variable of a tree data structure that has already 
  * been created.
  * Output: 
- * A tree data structure. with no data.
- * Procedure: This function traverses the created tree and deallocates memory to
- * each tree node in the data structure.
+ * A NULL tree handle.
+ * Procedure: Every node lives in the node array and every key in the key
+ * pool, so rather than traversing the tree this function frees those
+ * blocks, or unmaps the snapshot they were loaded from, before freeing
+ * the handle itself.
  */
 
 tree tree_free(tree t){
     if (t == NULL){
         return NULL;
     }
-    tree_free(t->right);
-    tree_free(t->left);
-    free(t->key);
+    if (t->map != NULL) {
+        munmap(t->map, t->map_len);
+    } else {
+        free(t->nodes);
+        free(t->keys);
+        free(t->slots);
+    }
+    tree_unfreeze(t);
+    if (t->sync != NULL) {
+        while (t->sync->n_retired > 0) {
+            free(t->sync->retired[--t->sync->n_retired]);
+        }
+        free(t->sync->retired);
+        pthread_mutex_destroy(&t->sync->lock);
+        free(t->sync);
+    }
     free(t);
-
     return NULL;
 }
+
+/**
+ * Function: tree_save()
+ * @param: tree t, FILE *out
+ * The t variable is the tree to save and out is the stream to save it to.
+ * Procedure: Writes a snapshot of the tree, see struct snapshot_header,
+ * which tree_load() can turn back into an identical tree.
+ * @return 0 if the snapshot was written, EOF if there was a write error.
+ */
+
+int tree_save(tree t, FILE *out) {
+    char header[SNAPSHOT_HEADER_SIZE];
+    struct snapshot_header *h = (struct snapshot_header *)header;
+    char pad[8] = { 0 };
+    size_t keys_pad = SNAPSHOT_ALIGN(t->keys_len) - t->keys_len;
+
+    memset(header, 0, sizeof header);
+    memcpy(h->magic, SNAPSHOT_MAGIC, sizeof h->magic);
+    h->version = SNAPSHOT_VERSION;
+    h->byte_order = SNAPSHOT_BYTE_ORDER;
+    h->node_size = sizeof t->nodes[0];
+    h->type = t->type;
+    h->root = t->root;
+    h->size = t->size;
+    h->keys_len = t->keys_len;
+    h->slot_mask = t->slot_mask;
+
+    fwrite(header, 1, sizeof header, out);
+    fwrite(t->nodes, sizeof t->nodes[0], t->size + 1, out);
+    fwrite(t->keys, 1, t->keys_len, out);
+    fwrite(pad, 1, keys_pad, out);
+    if (t->type == HASH) {
+        fwrite(t->slots, sizeof t->slots[0], t->slot_mask + 1, out);
+    }
+    return (fflush(out) == 0 && !ferror(out)) ? 0 : EOF;
+}
+
+/**
+ * Function: snapshot_valid()
+ * @param: tree t
+ * The t variable is a tree whose arrays have just been mapped from a
+ * snapshot, whose header has already been checked.
+ * Procedure: Checks everything in the arrays which is used as an index or
+ * an offset, so that a corrupt snapshot is turned away rather than read
+ * out of bounds. Every child and slot must be a node of the tree, every
+ * key must end with a nul inside the key pool, and no node can be the
+ * child of more than one other or of the root, so the links from the
+ * root form a tree rather than a loop. The NIL sentinel must be a black
+ * leaf counting nothing, and a HASH must have a power of two slots with
+ * at least one of them empty, or a search for a missing word would never
+ * stop. Once it is safe to walk, tree_valid() checks the rest: the
+ * prefixes and lengths of the keys, their order, the counts and totals
+ * and, in an RBT, the red-black properties. An RBT must also be shallow
+ * enough for the paths tree_add() and tree_remove() keep.
+ * @return 1 if the tree can be used, or 0 if not.
+ */
+
+static int snapshot_valid(tree t) {
+    unsigned int n = (unsigned int)t->size, i;
+    unsigned char *parents;
+    struct tree_node *x;
+    int valid = 1, empty = 0;
+
+    x = &t->nodes[NIL];
+    if (x->left != NIL || x->right != NIL || (x->info & 1) != BLACK
+        || x->count != 0 || x->total != 0) {
+        return 0;
+    }
+    if (t->type == HASH) {
+        if ((t->slot_mask & (t->slot_mask + 1)) != 0) {
+            return 0;
+        }
+        for (i = 0; i <= t->slot_mask; i++) {
+            if (t->slots[i].x > n) {
+                return 0;
+            }
+            empty |= (t->slots[i].x == NIL);
+        }
+        if (!empty) {
+            return 0;
+        }
+    }
+    parents = emalloc(n + 1);
+    memset(parents, 0, n + 1);
+    parents[t->root] = 1;
+    for (i = 0; i <= n && valid; i++) {
+        x = &t->nodes[i];
+        if (x->left > n || x->right > n
+            || (size_t)x->key + (x->info >> 1) >= t->keys_len
+            || t->keys[x->key + (x->info >> 1)] != '\0') {
+            valid = 0;
+        } else if (i != NIL && t->type != HASH) {
+            if ((x->left != NIL && parents[x->left]++ > 0)
+                || (x->right != NIL && parents[x->right]++ > 0)) {
+                valid = 0;
+            }
+        }
+    }
+    free(parents);
+    return valid && tree_valid(t)
+        && (t->type != RBT || tree_depth(t) < TREE_MAX_PATH);
+}
+
+/**
+ * Function: tree_load()
+ * @param: char *filename
+ * The filename variable names a snapshot written by tree_save().
+ * Procedure: Maps the snapshot into memory and points a new tree handle's
+ * node array, key pool and slot table into the mapping. Nothing is copied
+ * or inserted, but every node is read once by snapshot_valid(), which
+ * takes a fraction of the time rebuilding the tree would.
+ * @return the loaded tree, or NULL if the file could not be read or is
+ * not a valid snapshot.
+ */
+
+tree tree_load(char *filename) {
+    struct snapshot_header *h;
+    struct stat st;
+    size_t nodes_len, keys_len, slots_len;
+    char *map;
+    tree t;
+    int fd;
+
+    if ((fd = open(filename, O_RDONLY)) < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < SNAPSHOT_HEADER_SIZE) {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map) {
+        return NULL;
+    }
+
+    h = (struct snapshot_header *)map;
+    nodes_len = ((size_t)h->size + 1) * sizeof t->nodes[0];
+    keys_len = SNAPSHOT_ALIGN((size_t)h->keys_len);
+    slots_len = (h->type == HASH) ? ((size_t)h->slot_mask + 1) * sizeof t->slots[0] : 0;
+    if (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof h->magic) != 0
+        || h->version != SNAPSHOT_VERSION
+        || h->byte_order != SNAPSHOT_BYTE_ORDER
+        || h->node_size != sizeof t->nodes[0]
+        || h->type > HASH || h->root > h->size
+        || SNAPSHOT_HEADER_SIZE + nodes_len + keys_len + slots_len != (size_t)st.st_size) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    t = emalloc(sizeof *t);
+    t->type = (tree_t)h->type;
+    t->root = h->root;
+    t->size = h->size;
+    t->nodes = (struct tree_node *)(map + SNAPSHOT_HEADER_SIZE);
+    t->capacity = h->size + 1;
+    t->keys = map + SNAPSHOT_HEADER_SIZE + nodes_len;
+    t->keys_len = h->keys_len;
+    t->keys_size = h->keys_len;
+    t->slots = NULL;
+    t->slot_mask = 0;
+    if (t->type == HASH) {
+        t->slots = (struct tree_slot *)(t->keys + keys_len);
+        t->slot_mask = h->slot_mask;
+    }
+    t->map = map;
+    t->map_len = st.st_size;
+    t->sync = NULL;
+    t->frozen = NULL;
+    if (!snapshot_valid(t)) {
+        munmap(map, st.st_size);
+        free(t);
+        return NULL;
+    }
+    return t;
+}
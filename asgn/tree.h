@@ -10,24 +10,53 @@
  * This provides access to methods such as tree_new(), tree_insert(), 
  * right_rotate(), left_rotate(), tree_search(), tree_depth(), tree_fix(),
  * tree_preorder(). 
+ *
+ * A tree is a handle to one independent BST or RBT; several trees of
+ * either kind can be used side-by-side. A HASH is a hash table offering
+ * the same functions, with tree_preorder() visiting its words in sorted
+ * order.
+ *
+ * A tree is changed by one thread at a time, unless it has been passed to
+ * tree_share(), after which it can be changed from several threads while
+ * others search it with tree_search() and tree_frequency().
  */
 
 #ifndef TREE_H_
 #define TREE_H_
 
-typedef struct tree_node *tree;
-typedef enum tree_e { BST, RBT } tree_t;
+typedef struct tree_rec *tree;
+typedef enum tree_e { BST, RBT, HASH } tree_t;
 typedef enum { RED, BLACK } tree_colour;
 extern tree tree_free(tree t);
-extern void tree_inorder(tree t, void f(char *str));
+extern void tree_inorder(tree t, void f(int freq, char *str));
+extern void tree_prefix(tree t, char *prefix, void f(int freq, char *str));
+extern void tree_complete(tree t, char *prefix, int k, void f(int freq, char *str));
+extern void tree_top(tree t, int k, void f(int freq, char *str));
 extern void tree_preorder(tree t, void f(int freq, char *str));
-extern tree tree_insert(tree t, char *str);
-extern tree tree_new();
-extern tree rbt_insert(tree t, char *str);
-extern tree tree_fix();
+extern void tree_insert(tree t, char *str);
+extern int tree_delete(tree t, char *str);
+extern int tree_decrement(tree t, char *str);
+extern void tree_merge(tree dest, tree src);
+extern tree tree_copy(tree t);
+extern void tree_share(tree t);
+extern void tree_freeze(tree t);
+extern int tree_valid(tree t);
+extern tree tree_build(tree_t type, char **words, int n);
+extern tree tree_new(tree_t type);
 extern int tree_depth(tree t);
+extern int tree_size(tree t);
+extern size_t tree_memory(tree t);
+extern char *tree_word(tree t, int i, int *freq);
 extern int tree_search(tree t, char *str);
-extern void tree_output_dot(tree t, FILE *out);
+extern int tree_frequency(tree t, char *str);
+extern int tree_comparisons(tree t, char *str);
+extern int tree_rank(tree t, char *str);
+extern char *tree_select(tree t, int i);
+extern int tree_range_count(tree t, char *lo, char *hi);
+extern int tree_range_total(tree t, char *lo, char *hi);
+extern int tree_output_dot(tree t, FILE *out);
+extern int tree_save(tree t, FILE *out);
+extern tree tree_load(char *filename);
 
 #endif
 
@@ -0,0 +1,445 @@
+/**
+ * @file bench.c
+ *
+ * This program benchmarks the dictionary backends in tree.c against each
+ * other. For every combination of backend, corpus and size it fills a new
+ * tree with the corpus, searches it for every word of the corpus and frees
+ * it, and prints one line of JSON describing the run to stdout, so that
+ * results can be collected and compared between builds. With -q it also
+ * times that many autocomplete queries, each asking tree_complete() for
+ * the most frequent words starting with a prefix of a corpus word, and
+ * reports their latency percentiles.
+ *
+ * Each run happens in a child process so that the peak RSS it reports
+ * belongs to that run alone.
+ *
+ * Build it from the top of the repository with
+ *
+ *    gcc -O2 -W -Wall -ansi -pedantic -pthread -Iasgn bench/bench.c \
+ *        asgn/tree.c asgn/mylib.c -o tree-bench
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "tree.h"
+#include "mylib.h"
+
+/**
+ * Define:
+ * WORD_SIZE is the longest word read from a text corpus, as in asgn2.
+ * VOCAB_SIZE is the number of distinct words a Zipf corpus draws from.
+ * SORTED_BST_LIMIT is the largest sorted corpus a BST is given, since a
+ * BST built from sorted input takes quadratic time to fill.
+ * COMPLETE_LIMIT is how many words each autocomplete query asks for, and
+ * COMPLETE_PREFIX the longest prefix one is made with.
+ */
+#define WORD_SIZE 256
+#define VOCAB_SIZE 50000
+#define SORTED_BST_LIMIT 20000
+#define COMPLETE_LIMIT 10
+#define COMPLETE_PREFIX 4
+
+/**
+ * A corpus is a list of words held in an arena.
+ */
+struct corpus {
+    char **words;
+    int n;
+    arena strings;
+};
+
+static unsigned long rng_state = 88172645UL;
+static int queries = 0;
+static int completions;
+
+/**
+ * Function:
+ * A small xorshift random number generator, so the corpora generated are
+ * the same on every platform for a given seed.
+ * @return the next pseudo-random 32-bit number
+ */
+
+static unsigned long rng_next(void) {
+    rng_state ^= (rng_state << 13) & 0xFFFFFFFFUL;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= (rng_state << 5) & 0xFFFFFFFFUL;
+    return rng_state & 0xFFFFFFFFUL;
+}
+
+static double wall_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct corpus *corpus_new(int n) {
+    struct corpus *c = emalloc(sizeof *c);
+    c->words = emalloc((n > 0 ? n : 1) * sizeof c->words[0]);
+    c->n = 0;
+    c->strings = arena_new(1 << 20);
+    return c;
+}
+
+static void corpus_free(struct corpus *c) {
+    arena_free(c->strings);
+    free(c->words);
+    free(c);
+}
+
+/**
+ * Function:
+ * Makes up a random lowercase word of 3 to 12 letters.
+ * @param char *buf, where to write the word, at least 13 bytes
+ */
+
+static void random_word(char *buf) {
+    int len = 3 + rng_next() % 10;
+    int i;
+    for (i = 0; i < len; i++) {
+        buf[i] = 'a' + rng_next() % 26;
+    }
+    buf[len] = '\0';
+}
+
+static int str_cmp(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/**
+ * Function:
+ * Builds one of the generated corpora.
+ * random: n uniformly random words, almost all distinct.
+ * sorted: the random corpus in sorted order.
+ * zipf:   n words drawn from VOCAB_SIZE random words, the k-th most
+ *         common being drawn with probability proportional to 1/k, which
+ *         is roughly how words are distributed in real text.
+ * @param char *kind, the name of the corpus
+ * @param int n, the number of words to generate
+ * @return the corpus, or NULL if kind is not a known corpus
+ */
+
+static struct corpus *corpus_generate(char *kind, int n) {
+    struct corpus *c = corpus_new(n);
+    char buf[16];
+    char **vocab;
+    double *cdf, total = 0.0, r;
+    int i, lo, hi, mid;
+
+    if (strcmp(kind, "random") == 0 || strcmp(kind, "sorted") == 0) {
+        for (i = 0; i < n; i++) {
+            random_word(buf);
+            c->words[c->n++] = arena_strdup(c->strings, buf);
+        }
+        if (strcmp(kind, "sorted") == 0) {
+            qsort(c->words, c->n, sizeof c->words[0], str_cmp);
+        }
+    } else if (strcmp(kind, "zipf") == 0) {
+        vocab = emalloc(VOCAB_SIZE * sizeof vocab[0]);
+        cdf = emalloc(VOCAB_SIZE * sizeof cdf[0]);
+        for (i = 0; i < VOCAB_SIZE; i++) {
+            random_word(buf);
+            vocab[i] = arena_strdup(c->strings, buf);
+            total += 1.0 / (i + 1);
+            cdf[i] = total;
+        }
+        for (i = 0; i < n; i++) {
+            r = rng_next() / 4294967296.0 * total;
+            lo = 0;
+            hi = VOCAB_SIZE - 1;
+            while (lo < hi) {
+                mid = (lo + hi) / 2;
+                if (cdf[mid] < r) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            c->words[c->n++] = vocab[lo];
+        }
+        free(vocab);
+        free(cdf);
+    } else {
+        corpus_free(c);
+        return NULL;
+    }
+    return c;
+}
+
+/**
+ * Function:
+ * Reads up to n words from a text file, using the same tokenizer as asgn2.
+ * @param char *filename, the file to read
+ * @param int n, the most words to read
+ * @return the corpus, which holds fewer than n words if the file is short
+ */
+
+static struct corpus *corpus_load(char *filename, int n) {
+    struct corpus *c = corpus_new(n);
+    FILE *in = fopen(filename, "r");
+    tokenizer tk;
+    char *word;
+    if (NULL == in) {
+        fprintf(stderr, "Can't find file %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    tk = tokenizer_open(in, WORD_SIZE);
+    while (c->n < n && tokenizer_next(tk, &word) != EOF) {
+        c->words[c->n++] = arena_strdup(c->strings, word);
+    }
+    tokenizer_free(tk);
+    fclose(in);
+    return c;
+}
+
+static int double_cmp(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void count_completion(int freq, char *word) {
+    (void) freq;
+    (void) word;
+    completions++;
+}
+
+/**
+ * Function:
+ * Times queries autocomplete queries against a tree, each for a prefix of
+ * 1 to COMPLETE_PREFIX letters taken from a random word of the corpus.
+ * @param tree t, the tree to query
+ * @param struct corpus *c, the corpus the tree was filled with
+ * @param double *p50, set to the median latency in microseconds
+ * @param double *p99, set to the 99th percentile latency in microseconds
+ * @param double *max, set to the worst latency in microseconds
+ */
+
+static void time_completions(tree t, struct corpus *c, double *p50, double *p99,
+                             double *max) {
+    double *latency = emalloc(queries * sizeof latency[0]);
+    char prefix[COMPLETE_PREFIX + 1];
+    double start;
+    char *word;
+    int i;
+
+    completions = 0;
+    for (i = 0; i < queries; i++) {
+        word = c->words[rng_next() % c->n];
+        strncpy(prefix, word, COMPLETE_PREFIX);
+        prefix[1 + rng_next() % COMPLETE_PREFIX] = '\0';
+        start = wall_time();
+        tree_complete(t, prefix, COMPLETE_LIMIT, count_completion);
+        latency[i] = (wall_time() - start) * 1e6;
+    }
+    qsort(latency, queries, sizeof latency[0], double_cmp);
+    *p50 = latency[queries / 2];
+    *p99 = latency[queries * 99 / 100];
+    *max = latency[queries - 1];
+    free(latency);
+}
+
+static char *type_name(tree_t type) {
+    switch (type) {
+        case BST:
+            return "bst";
+        case RBT:
+            return "rbt";
+        default:
+            return "hash";
+    }
+}
+
+/**
+ * Function:
+ * Fills, searches and frees one tree, then prints the results as JSON.
+ * The comparisons per lookup are counted in a separate, untimed pass, and
+ * autocomplete queries are timed after that if -q was given.
+ * @param tree_t type, the backend to benchmark
+ * @param char *kind, the name of the corpus, for the output
+ * @param struct corpus *c, the words to fill and search with
+ */
+
+static void run(tree_t type, char *kind, struct corpus *c) {
+    struct rusage usage;
+    double start, fill, search, release, comparisons = 0.0;
+    double p50 = 0.0, p99 = 0.0, max = 0.0;
+    int i, found = 0, depth, distinct;
+    tree t;
+
+    start = wall_time();
+    t = tree_new(type);
+    for (i = 0; i < c->n; i++) {
+        tree_insert(t, c->words[i]);
+    }
+    fill = wall_time() - start;
+
+    start = wall_time();
+    for (i = 0; i < c->n; i++) {
+        found += tree_search(t, c->words[i]);
+    }
+    search = wall_time() - start;
+
+    for (i = 0; i < c->n; i++) {
+        comparisons += tree_comparisons(t, c->words[i]);
+    }
+    depth = tree_depth(t);
+    distinct = tree_size(t);
+    if (queries > 0 && c->n > 0) {
+        time_completions(t, c, &p50, &p99, &max);
+    }
+
+    start = wall_time();
+    t = tree_free(t);
+    release = wall_time() - start;
+
+    getrusage(RUSAGE_SELF, &usage);
+    printf("{\"backend\":\"%s\",\"corpus\":\"%s\",\"n\":%d,\"distinct\":%d,"
+           "\"fill_s\":%.6f,\"fill_ns_per_op\":%.1f,"
+           "\"search_s\":%.6f,\"search_ns_per_op\":%.1f,\"found\":%d,"
+           "\"free_s\":%.6f,\"depth\":%d,\"cmp_per_lookup\":%.2f,"
+           "\"peak_rss_kb\":%ld",
+           type_name(type), kind, c->n, distinct,
+           fill, c->n ? fill * 1e9 / c->n : 0.0,
+           search, c->n ? search * 1e9 / c->n : 0.0, found,
+           release, depth, c->n ? comparisons / c->n : 0.0,
+           usage.ru_maxrss);
+    if (queries > 0 && c->n > 0) {
+        printf(",\"complete_queries\":%d,\"complete_results\":%d,"
+               "\"complete_p50_us\":%.2f,\"complete_p99_us\":%.2f,"
+               "\"complete_max_us\":%.2f",
+               queries, completions, p50, p99, max);
+    }
+    printf("}\n");
+    fflush(stdout);
+}
+
+static void print_usage(char *progname) {
+    fprintf(stderr, "Usage: %s [OPTION]...\n", progname);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Benchmark filling, searching and freeing each tree backend, printing\none JSON object per run to stdout.\n\n");
+    fprintf(stderr, "-b LIST\t\tBackends to run, from bst,rbt,hash (default all)\n");
+    fprintf(stderr, "-c LIST\t\tCorpora to use, from random,sorted,zipf,text\n\t\t(default random,sorted,zipf, plus text if -f given)\n");
+    fprintf(stderr, "-f FILENAME\tRead the text corpus from FILENAME\n");
+    fprintf(stderr, "-q QUERIES\tAlso time QUERIES autocomplete queries per run\n");
+    fprintf(stderr, "-n LIST\t\tCorpus sizes in words (default 1000,10000,100000)\n");
+    fprintf(stderr, "-s SEED\t\tSeed for the generated corpora\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "-h\t\tPrint this message\n");
+}
+
+/**
+ * Function:
+ * Runs every requested combination of backend, corpus and size, each in
+ * its own child process.
+ * @return EXIT_SUCCESS if every run completed.
+ */
+
+int main(int argc, char *argv[]) {
+    const char *optstring = "b:c:f:n:q:s:h";
+    char *backends = "bst,rbt,hash";
+    char *corpora = NULL;
+    char *sizes = "1000,10000,100000";
+    char *textFile = NULL;
+    char *kind, *size, *name;
+    char *kinds, *sizelist, *backlist;
+    char *kind_save, *size_save, *back_save;
+    struct corpus *c;
+    tree_t type;
+    pid_t pid;
+    int option, status, n, failed = 0;
+
+    while ((option = getopt(argc, argv, optstring)) != EOF) {
+        switch (option) {
+            case 'b':
+                backends = optarg;
+                break;
+            case 'c':
+                corpora = optarg;
+                break;
+            case 'f':
+                textFile = optarg;
+                break;
+            case 'n':
+                sizes = optarg;
+                break;
+            case 'q':
+                queries = atoi(optarg);
+                break;
+            case 's':
+                rng_state = strtoul(optarg, NULL, 10) | 1;
+                break;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (NULL == corpora) {
+        corpora = (NULL == textFile) ? "random,sorted,zipf" : "random,sorted,zipf,text";
+    }
+
+    kinds = emalloc(strlen(corpora) + 1);
+    strcpy(kinds, corpora);
+    for (kind = strtok_r(kinds, ",", &kind_save); kind != NULL;
+         kind = strtok_r(NULL, ",", &kind_save)) {
+        sizelist = emalloc(strlen(sizes) + 1);
+        strcpy(sizelist, sizes);
+        for (size = strtok_r(sizelist, ",", &size_save); size != NULL;
+             size = strtok_r(NULL, ",", &size_save)) {
+            n = atoi(size);
+            if (strcmp(kind, "text") == 0) {
+                if (NULL == textFile) {
+                    fprintf(stderr, "The text corpus needs -f FILENAME\n");
+                    return EXIT_FAILURE;
+                }
+                c = corpus_load(textFile, n);
+            } else if (NULL == (c = corpus_generate(kind, n))) {
+                fprintf(stderr, "Unknown corpus '%s'\n", kind);
+                return EXIT_FAILURE;
+            }
+
+            backlist = emalloc(strlen(backends) + 1);
+            strcpy(backlist, backends);
+            for (name = strtok_r(backlist, ",", &back_save); name != NULL;
+                 name = strtok_r(NULL, ",", &back_save)) {
+                if (strcmp(name, "bst") == 0) {
+                    type = BST;
+                } else if (strcmp(name, "rbt") == 0) {
+                    type = RBT;
+                } else if (strcmp(name, "hash") == 0) {
+                    type = HASH;
+                } else {
+                    fprintf(stderr, "Unknown backend '%s'\n", name);
+                    return EXIT_FAILURE;
+                }
+                if (type == BST && strcmp(kind, "sorted") == 0 && c->n > SORTED_BST_LIMIT) {
+                    printf("{\"backend\":\"bst\",\"corpus\":\"sorted\",\"n\":%d,\"skipped\":true}\n", c->n);
+                    fflush(stdout);
+                    continue;
+                }
+                if ((pid = fork()) == 0) {
+                    run(type, kind, c);
+                    exit(EXIT_SUCCESS);
+                } else if (pid < 0 || waitpid(pid, &status, 0) < 0
+                           || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                    fprintf(stderr, "Run of %s on %s/%d failed\n", name, kind, n);
+                    failed = 1;
+                }
+            }
+            free(backlist);
+            corpus_free(c);
+        }
+        free(sizelist);
+    }
+    free(kinds);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,288 @@
+/**
+ * @file client.c
+ *
+ * This program is a load generator for the word-count server started
+ * with asgn2 -p SOCKET. Each of several connections sends batches of
+ * requests for words drawn at random from a text file, waiting for the
+ * replies to each batch before sending the next, and the time every
+ * batch takes to be answered is recorded. When every connection has
+ * finished one line of JSON giving the throughput in requests per second
+ * and the batch latency percentiles is printed to stdout.
+ *
+ * Build it from the top of the repository with
+ *
+ *    gcc -O2 -W -Wall -ansi -pedantic -pthread -Iasgn bench/client.c \
+ *        asgn/mylib.c -o tree-client
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "mylib.h"
+
+/**
+ * Define:
+ * WORD_SIZE is the longest word read from the word file, as in asgn2.
+ * MAX_BATCH is the most requests a batch can hold. A batch is written
+ * whole before its replies are read, so it has to fit in the socket's
+ * buffers along with the replies.
+ */
+#define WORD_SIZE 256
+#define MAX_BATCH 1000
+
+/**
+ * A load job is one connection's share of the load, with the latency of
+ * each of its batches in microseconds.
+ */
+struct load_job {
+    pthread_t id;
+    unsigned long rng_state;
+    double *latency;
+    long known;
+    long errors;
+    int failed;
+};
+
+static char *socketPath;
+static char **words;
+static int n_words = 0;
+static int batch = 100;
+static int batches = 1000;
+static int writes = 0;
+
+/**
+ * Function:
+ * A small xorshift random number generator, as in bench.c, with a state
+ * of its own for each connection.
+ * @return the next pseudo-random 32-bit number
+ */
+
+static unsigned long rng_next(unsigned long *state) {
+    *state ^= (*state << 13) & 0xFFFFFFFFUL;
+    *state ^= *state >> 17;
+    *state ^= (*state << 5) & 0xFFFFFFFFUL;
+    return *state & 0xFFFFFFFFUL;
+}
+
+static double wall_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int double_cmp(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int server_connect(void) {
+    struct sockaddr_un addr;
+    int fd;
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath, sizeof addr.sun_path - 1);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof addr) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Function:
+ * Sends a connection's batches, each made of frequency requests and
+ * writes percent of insert requests, and times the replies to each.
+ * @param void *arg, the struct load_job to run
+ */
+
+static void *load_worker(void *arg) {
+    struct load_job *job = arg;
+    char *out = emalloc(MAX_BATCH * (WORD_SIZE + 3));
+    char in[1 << 12];
+    size_t len, sent;
+    ssize_t got;
+    double start;
+    int fd, b, i, lines, at_line_start;
+    char *word;
+
+    if ((fd = server_connect()) < 0) {
+        job->failed = 1;
+        free(out);
+        return NULL;
+    }
+    for (b = 0; b < batches && !job->failed; b++) {
+        len = 0;
+        for (i = 0; i < batch; i++) {
+            word = words[rng_next(&job->rng_state) % n_words];
+            out[len++] = ((int)(rng_next(&job->rng_state) % 100) < writes) ? '+' : 'f';
+            out[len++] = ' ';
+            strcpy(out + len, word);
+            len += strlen(word);
+            out[len++] = '\n';
+        }
+        start = wall_time();
+        for (sent = 0; sent < len; sent += got) {
+            if ((got = write(fd, out + sent, len - sent)) <= 0) {
+                job->failed = 1;
+                break;
+            }
+        }
+        lines = 0;
+        at_line_start = 1;
+        while (!job->failed && lines < batch) {
+            if ((got = read(fd, in, sizeof in)) <= 0) {
+                job->failed = 1;
+                break;
+            }
+            for (i = 0; i < got; i++) {
+                if (at_line_start) {
+                    if (in[i] == '?') {
+                        job->errors++;
+                    } else if (in[i] != '0') {
+                        job->known++;
+                    }
+                }
+                at_line_start = (in[i] == '\n');
+                lines += at_line_start;
+            }
+        }
+        job->latency[b] = (wall_time() - start) * 1e6;
+    }
+    close(fd);
+    free(out);
+    return NULL;
+}
+
+static void print_usage(char *progname) {
+    fprintf(stderr, "Usage: %s [OPTION]... SOCKET WORDFILE\n", progname);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Send batches of requests for random words from WORDFILE to the server\nlistening on SOCKET, then print the throughput and batch latencies as\nJSON to stdout.\n\n");
+    fprintf(stderr, "-b BATCH\tRequests per batch, at most %d (default 100)\n", MAX_BATCH);
+    fprintf(stderr, "-c CONNECTIONS\tConnections sending batches at once (default 4)\n");
+    fprintf(stderr, "-n BATCHES\tBatches sent by each connection (default 1000)\n");
+    fprintf(stderr, "-s SEED\t\tSeed for choosing words\n");
+    fprintf(stderr, "-w PERCENT\tPercentage of requests which insert their word\n\t\tinstead of asking its frequency (default 0)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "-h\t\tPrint this message\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *optstring = "b:c:n:s:w:h";
+    struct load_job *jobs;
+    double *latency;
+    double start, seconds;
+    unsigned long seed = 88172645UL;
+    arena strings;
+    tokenizer tk;
+    FILE *in;
+    char *word;
+    int option, connections = 4, size = 1024, i, n = 0, failed = 0;
+    long known = 0, errors = 0;
+
+    while ((option = getopt(argc, argv, optstring)) != EOF) {
+        switch (option) {
+            case 'b':
+                batch = atoi(optarg);
+                break;
+            case 'c':
+                connections = atoi(optarg);
+                break;
+            case 'n':
+                batches = atoi(optarg);
+                break;
+            case 's':
+                seed = strtoul(optarg, NULL, 10) | 1;
+                break;
+            case 'w':
+                writes = atoi(optarg);
+                break;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind != 2 || batch < 1 || batch > MAX_BATCH || connections < 1
+        || batches < 1) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    socketPath = argv[optind];
+
+    if (NULL == (in = fopen(argv[optind + 1], "r"))) {
+        fprintf(stderr, "Can't find file %s\n", argv[optind + 1]);
+        return EXIT_FAILURE;
+    }
+    strings = arena_new(1 << 20);
+    words = emalloc(size * sizeof words[0]);
+    tk = tokenizer_open(in, WORD_SIZE);
+    while (tokenizer_next(tk, &word) != EOF) {
+        if (n_words == size) {
+            size *= 2;
+            words = erealloc(words, size * sizeof words[0]);
+        }
+        words[n_words++] = arena_strdup(strings, word);
+    }
+    tokenizer_free(tk);
+    fclose(in);
+    if (n_words == 0) {
+        fprintf(stderr, "No words in %s\n", argv[optind + 1]);
+        return EXIT_FAILURE;
+    }
+
+    jobs = emalloc(connections * sizeof jobs[0]);
+    start = wall_time();
+    for (i = 0; i < connections; i++) {
+        jobs[i].rng_state = (seed + 2 * i) | 1;
+        jobs[i].latency = emalloc(batches * sizeof jobs[i].latency[0]);
+        jobs[i].known = 0;
+        jobs[i].errors = 0;
+        jobs[i].failed = 0;
+        if (pthread_create(&jobs[i].id, NULL, load_worker, &jobs[i]) != 0) {
+            fprintf(stderr, "Failed to create thread\n");
+            return EXIT_FAILURE;
+        }
+    }
+    latency = emalloc(connections * batches * sizeof latency[0]);
+    for (i = 0; i < connections; i++) {
+        pthread_join(jobs[i].id, NULL);
+        failed |= jobs[i].failed;
+        known += jobs[i].known;
+        errors += jobs[i].errors;
+        memcpy(latency + n, jobs[i].latency, batches * sizeof latency[0]);
+        n += batches;
+        free(jobs[i].latency);
+    }
+    seconds = wall_time() - start;
+    if (failed) {
+        fprintf(stderr, "Lost the connection to %s\n", socketPath);
+        return EXIT_FAILURE;
+    }
+
+    qsort(latency, n, sizeof latency[0], double_cmp);
+    printf("{\"connections\":%d,\"batch\":%d,\"batches\":%d,\"write_percent\":%d,"
+           "\"requests\":%ld,\"known\":%ld,\"errors\":%ld,\"seconds\":%.3f,"
+           "\"qps\":%.0f,\"batch_p50_us\":%.1f,\"batch_p99_us\":%.1f,"
+           "\"batch_max_us\":%.1f}\n",
+           connections, batch, n, writes, (long)n * batch, known, errors, seconds,
+           n * (double)batch / seconds, latency[n / 2], latency[(long)n * 99 / 100],
+           latency[n - 1]);
+
+    free(latency);
+    free(jobs);
+    free(words);
+    arena_free(strings);
+    return EXIT_SUCCESS;
+}
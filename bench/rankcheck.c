@@ -0,0 +1,317 @@
+/**
+ * @file rankcheck.c
+ *
+ * This program checks tree_rank(), tree_select(), tree_range_count() and
+ * tree_range_total() against brute force, for a BST, an RBT and a hash
+ * table. Each tree is given a random mix of inserts, decrements and
+ * deletes of words from a small vocabulary, while an array holds the
+ * frequency every word should have. Every so often the tree is checked
+ * with tree_valid() and its answers compared with ones worked out from
+ * the array by comparing every word, for words in the tree, words not in
+ * it and strings sorting between them.
+ *
+ * The vocabulary is first inserted in sorted order, which makes a BST far
+ * deeper than the path tree_add() remembers, and later halfway through a
+ * copy of the tree made with tree_copy() is checked as well.
+ *
+ * One line of JSON giving the counts is printed to stdout, and the first
+ * few differences to stderr. The exit status is non-zero if there were
+ * any.
+ *
+ * Build it from the top of the repository with
+ *
+ *    gcc -O2 -W -Wall -ansi -pedantic -pthread -Iasgn bench/rankcheck.c \
+ *        asgn/tree.c asgn/mylib.c -o tree-rankcheck
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "tree.h"
+#include "mylib.h"
+
+/**
+ * Define:
+ * MAX_WORD is the longest vocabulary word. CHECK_PROBES is how many
+ * strings are looked up at each check, and MAX_REPORTS the most
+ * differences printed.
+ */
+#define MAX_WORD 12
+#define CHECK_PROBES 200
+#define MAX_REPORTS 10
+
+static char **vocab;
+static int *expected;
+static int n_vocab = 0;
+
+static long checks = 0;
+static long probes = 0;
+static long mismatches = 0;
+
+static unsigned long rng_state = 88172645UL;
+
+/**
+ * Function:
+ * A small xorshift random number generator, as in bench.c.
+ * @return the next pseudo-random 32-bit number
+ */
+
+static unsigned long rng_next(void) {
+    rng_state ^= (rng_state << 13) & 0xFFFFFFFFUL;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= (rng_state << 5) & 0xFFFFFFFFUL;
+    return rng_state & 0xFFFFFFFFUL;
+}
+
+static int word_cmp(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/**
+ * Function:
+ * Makes a sorted vocabulary of up to size distinct random words. Short
+ * words come up often, so that many words are prefixes of others.
+ */
+
+static void vocab_new(int size) {
+    int i, j, len;
+    vocab = emalloc(size * sizeof vocab[0]);
+    for (i = 0; i < size; i++) {
+        len = 1 + rng_next() % (1 + rng_next() % MAX_WORD);
+        vocab[i] = emalloc(len + 1);
+        for (j = 0; j < len; j++) {
+            vocab[i][j] = 'a' + rng_next() % 6;
+        }
+        vocab[i][len] = '\0';
+    }
+    qsort(vocab, size, sizeof vocab[0], word_cmp);
+    for (i = 0; i < size; i++) {
+        if (n_vocab > 0 && strcmp(vocab[n_vocab - 1], vocab[i]) == 0) {
+            free(vocab[i]);
+        } else {
+            vocab[n_vocab++] = vocab[i];
+        }
+    }
+    expected = emalloc(n_vocab * sizeof expected[0]);
+}
+
+static void mismatch(const char *type, const char *what, const char *str, long want,
+                     long got) {
+    if (++mismatches <= MAX_REPORTS) {
+        fprintf(stderr, "%s: %s(\"%s\") gave %ld, not %ld\n", type, what, str, got, want);
+    }
+}
+
+/**
+ * Function:
+ * Counts the words in the tree before str, and adds up their frequencies,
+ * by comparing every word of the vocabulary with it.
+ */
+
+static void brute_below(const char *str, long *count, long *total) {
+    int i;
+    *count = 0;
+    *total = 0;
+    for (i = 0; i < n_vocab && strcmp(vocab[i], str) < 0; i++) {
+        if (expected[i] > 0) {
+            *count += 1;
+            *total += expected[i];
+        }
+    }
+}
+
+/**
+ * Function:
+ * Returns a string to look up: a word of the vocabulary, one with a letter
+ * more or less, so that it sorts next to a word, or one before or after
+ * every word.
+ */
+
+static char *probe_string(char *buf) {
+    char *word = vocab[rng_next() % n_vocab];
+    size_t len = strlen(word);
+    switch (rng_next() % 5) {
+        case 0:
+            return "";
+        case 1:
+            strcpy(buf, word);
+            buf[len] = 'a' + rng_next() % 7;
+            buf[len + 1] = '\0';
+            return buf;
+        case 2:
+            strcpy(buf, word);
+            buf[len - 1] = '\0';
+            return buf;
+        case 3:
+            return (rng_next() % 2) ? "zzz" : "a";
+    }
+    return word;
+}
+
+/**
+ * Function:
+ * Checks every answer of t against the vocabulary's frequencies.
+ */
+
+static void check(tree t, const char *type) {
+    char lo_buf[MAX_WORD + 2], hi_buf[MAX_WORD + 2];
+    char *lo, *hi, *word;
+    long lo_count, lo_total, hi_count, hi_total, size = 0;
+    int i, r, *present;
+
+    checks++;
+    if (!tree_valid(t)) {
+        mismatch(type, "tree_valid", "", 1, 0);
+    }
+    present = emalloc(n_vocab * sizeof present[0]);
+    for (i = 0; i < n_vocab; i++) {
+        if (expected[i] > 0) {
+            present[size++] = i;
+        }
+    }
+    if (tree_size(t) != size) {
+        mismatch(type, "tree_size", "", size, tree_size(t));
+    }
+    if (tree_select(t, -1) != NULL || tree_select(t, size) != NULL) {
+        mismatch(type, "tree_select", "out of range", 0, 1);
+    }
+    for (i = 0; i < CHECK_PROBES; i++) {
+        probes++;
+        lo = probe_string(lo_buf);
+        hi = probe_string(hi_buf);
+        brute_below(lo, &lo_count, &lo_total);
+        brute_below(hi, &hi_count, &hi_total);
+        if (tree_rank(t, lo) != lo_count) {
+            mismatch(type, "tree_rank", lo, lo_count, tree_rank(t, lo));
+        }
+        if (strcmp(lo, hi) >= 0) {
+            hi_count = lo_count;
+            hi_total = lo_total;
+        }
+        if (tree_range_count(t, lo, hi) != hi_count - lo_count) {
+            mismatch(type, "tree_range_count", lo, hi_count - lo_count,
+                     tree_range_count(t, lo, hi));
+        }
+        if (tree_range_total(t, lo, hi) != hi_total - lo_total) {
+            mismatch(type, "tree_range_total", lo, hi_total - lo_total,
+                     tree_range_total(t, lo, hi));
+        }
+        if (size > 0) {
+            r = rng_next() % size;
+            word = tree_select(t, r);
+            if ((NULL == word || strcmp(word, vocab[present[r]]) != 0)
+                && ++mismatches <= MAX_REPORTS) {
+                fprintf(stderr, "%s: tree_select(%d) gave \"%s\", not \"%s\"\n", type, r,
+                        NULL == word ? "(null)" : word, vocab[present[r]]);
+            }
+        }
+    }
+    free(present);
+}
+
+/**
+ * Function:
+ * Runs ops random changes on a new tree of the given type, checking it
+ * every check_every changes.
+ */
+
+static void run(tree_t type, long ops, int check_every) {
+    const char *name = (type == BST) ? "bst" : (type == RBT) ? "rbt" : "hash";
+    tree t = tree_new(type), copy;
+    long op;
+    int i, r, got;
+
+    for (i = 0; i < n_vocab; i++) {
+        tree_insert(t, vocab[i]);
+        expected[i] = 1;
+    }
+    check(t, name);
+    for (op = 1; op <= ops; op++) {
+        i = rng_next() % n_vocab;
+        r = rng_next() % 100;
+        if (r < 60) {
+            tree_insert(t, vocab[i]);
+            expected[i]++;
+        } else if (r < 90) {
+            got = tree_decrement(t, vocab[i]);
+            if (got != expected[i] - 1) {
+                mismatch(name, "tree_decrement", vocab[i], expected[i] - 1, got);
+            }
+            if (expected[i] > 0) {
+                expected[i]--;
+            }
+        } else {
+            got = tree_delete(t, vocab[i]);
+            if (got != (expected[i] > 0)) {
+                mismatch(name, "tree_delete", vocab[i], expected[i] > 0, got);
+            }
+            expected[i] = 0;
+        }
+        if (op % check_every == 0) {
+            check(t, name);
+        }
+        if (op == ops / 2) {
+            copy = tree_copy(t);
+            check(copy, name);
+            tree_free(copy);
+        }
+    }
+    tree_free(t);
+}
+
+static void print_usage(char *progname) {
+    fprintf(stderr, "Usage: %s [OPTION]...\n", progname);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Check the rank, select and range functions of each kind of tree against\nbrute force, printing the results as JSON to stdout.\n\n");
+    fprintf(stderr, "-c OPS\t\tCheck the tree every OPS changes (default 1000)\n");
+    fprintf(stderr, "-n OPS\t\tMake OPS random changes to each tree (default 200000)\n");
+    fprintf(stderr, "-w WORDS\tUse a vocabulary of up to WORDS words (default 2000)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "-h\t\tPrint this message\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *optstring = "c:n:w:h";
+    long ops = 200000;
+    int option, check_every = 1000, words = 2000, i;
+
+    while ((option = getopt(argc, argv, optstring)) != EOF) {
+        switch (option) {
+            case 'c':
+                check_every = atoi(optarg);
+                break;
+            case 'n':
+                ops = atol(optarg);
+                break;
+            case 'w':
+                words = atoi(optarg);
+                break;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc || check_every < 1 || ops < 0 || words < 1) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    vocab_new(words);
+    run(BST, ops, check_every);
+    run(RBT, ops, check_every);
+    run(HASH, ops, check_every);
+
+    printf("{\"types\":[\"bst\",\"rbt\",\"hash\"],\"words\":%d,\"ops\":%ld,"
+           "\"checks\":%ld,\"probes\":%ld,\"mismatches\":%ld}\n",
+           n_vocab, ops, checks, probes, mismatches);
+
+    for (i = 0; i < n_vocab; i++) {
+        free(vocab[i]);
+    }
+    free(vocab);
+    free(expected);
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,250 @@
+/**
+ * @file spillcheck.c
+ *
+ * This program checks that asgn2 -x, see spill.h, counts words within its
+ * memory budget. It writes a text about eight times the size of the
+ * budget, mostly of words found nowhere else along with some which come up
+ * again and again, and has the asgn2 program named on the command line
+ * count it with -x, once given the file by name and once on stdin. The
+ * peak RSS of those runs, from getrusage(), must stay under the budget
+ * plus a fixed allowance for the program itself and its input buffers,
+ * and the words and frequencies they print must be the same as those of
+ * asgn2 -r -i counting the text in memory. With -t the runs with -x use a
+ * hash table, which has to sort its words before writing each one out.
+ *
+ * The children's peak RSS is only known as the largest of any child
+ * waited for so far, so the runs with -x all come before the one without.
+ *
+ * One line of JSON giving the results is printed to stdout, and the exit
+ * status is non-zero if a check failed.
+ *
+ * Build it from the top of the repository with
+ *
+ *    gcc -O2 -W -Wall -ansi -pedantic -Iasgn bench/spillcheck.c \
+ *        asgn/mylib.c -o tree-spillcheck
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "mylib.h"
+
+/**
+ * Define:
+ * INPUT_FACTOR is how many times bigger than the budget the text is.
+ * REPEATED_WORDS is how many words come up again and again in it.
+ */
+#define INPUT_FACTOR 8
+#define REPEATED_WORDS 1000
+
+static unsigned long rng_state = 88172645UL;
+
+/**
+ * Function:
+ * A small xorshift random number generator, as in bench.c.
+ * @return the next pseudo-random 32-bit number
+ */
+
+static unsigned long rng_next(void) {
+    rng_state ^= (rng_state << 13) & 0xFFFFFFFFUL;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= (rng_state << 5) & 0xFFFFFFFFUL;
+    return rng_state & 0xFFFFFFFFUL;
+}
+
+/**
+ * Function:
+ * Writes a text of at least size bytes to a new temporary file. Nine words
+ * in ten are ten random letters, so almost all are different, and the rest
+ * are picked from a few short ones, so frequencies have to be added up
+ * across runs.
+ * @return the file's path, which the caller must remove and free
+ */
+
+static char *write_text(long size) {
+    char *path = strcpy(emalloc(32), "/tmp/spillcheck-XXXXXX");
+    long written = 0;
+    unsigned long r;
+    FILE *out;
+    int fd, i, len;
+
+    if ((fd = mkstemp(path)) < 0 || NULL == (out = fdopen(fd, "w"))) {
+        fprintf(stderr, "Can't make a temporary file\n");
+        exit(EXIT_FAILURE);
+    }
+    while (written < size) {
+        if (rng_next() % 10 == 0) {
+            r = rng_next() % REPEATED_WORDS;
+            len = fprintf(out, "Word%lu, ", r);
+        } else {
+            for (i = 0; i < 10; i++) {
+                putc('a' + rng_next() % 26, out);
+            }
+            putc(' ', out);
+            len = 11;
+        }
+        written += len;
+    }
+    putc('\n', out);
+    if (fclose(out) != 0) {
+        fprintf(stderr, "Can't write %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    return path;
+}
+
+/**
+ * Function:
+ * Runs a program with its stdin read from in, if in isn't NULL, its stdout
+ * written to out and its stderr thrown away.
+ * @return 1 if it exited with status 0, otherwise 0
+ */
+
+static int run(char **args, const char *in, const char *out) {
+    pid_t pid;
+    int status, fd;
+
+    if ((pid = fork()) < 0) {
+        fprintf(stderr, "Can't fork\n");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        if ((in != NULL && ((fd = open(in, O_RDONLY)) < 0 || dup2(fd, 0) < 0))
+            || (fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0 || dup2(fd, 1) < 0
+            || (fd = open("/dev/null", O_WRONLY)) < 0 || dup2(fd, 2) < 0) {
+            _exit(EXIT_FAILURE);
+        }
+        execv(args[0], args);
+        _exit(EXIT_FAILURE);
+    }
+    return waitpid(pid, &status, 0) == pid && WIFEXITED(status)
+        && WEXITSTATUS(status) == 0;
+}
+
+/**
+ * Function:
+ * Returns the largest peak RSS of any child waited for so far, in KB.
+ */
+
+static long children_rss(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_CHILDREN, &usage);
+    return usage.ru_maxrss;
+}
+
+static int same_files(const char *a, const char *b) {
+    FILE *fa = fopen(a, "rb"), *fb = fopen(b, "rb");
+    int ca, cb, same = (fa != NULL && fb != NULL);
+    while (same) {
+        ca = getc(fa);
+        cb = getc(fb);
+        same = (ca == cb);
+        if (ca == EOF) {
+            break;
+        }
+    }
+    if (fa != NULL) {
+        fclose(fa);
+    }
+    if (fb != NULL) {
+        fclose(fb);
+    }
+    return same;
+}
+
+static void print_usage(char *progname) {
+    fprintf(stderr, "Usage: %s [OPTION]... ASGN2\n", progname);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Check that the asgn2 program at ASGN2 counts a text several times\nbigger than its -x budget within that budget, printing the results\nas JSON to stdout.\n\n");
+    fprintf(stderr, "-a MEGABYTES\tMemory allowed on top of the budget (default 8)\n");
+    fprintf(stderr, "-t\t\tGive asgn2 -t as well, so it counts with a hash table\n");
+    fprintf(stderr, "-x MEGABYTES\tThe budget given to asgn2 -x (default 16)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "-h\t\tPrint this message\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *optstring = "a:tx:h";
+    char *args[6], budget_arg[32];
+    char *text, *want, *got_file, *got_stdin;
+    long budget = 16, allowance = 8, spill_rss, memory_rss;
+    int option, ok_file, ok_stdin, ok_memory, same_file, same_stdin, passed;
+    int hash = 0, n;
+
+    while ((option = getopt(argc, argv, optstring)) != EOF) {
+        switch (option) {
+            case 'a':
+                allowance = atol(optarg);
+                break;
+            case 't':
+                hash = 1;
+                break;
+            case 'x':
+                budget = atol(optarg);
+                break;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind != 1 || budget < 1 || allowance < 0) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    text = write_text(INPUT_FACTOR * budget << 20);
+    want = strcat(strcpy(emalloc(strlen(text) + 6), text), ".want");
+    got_file = strcat(strcpy(emalloc(strlen(text) + 6), text), ".file");
+    got_stdin = strcat(strcpy(emalloc(strlen(text) + 7), text), ".stdin");
+    sprintf(budget_arg, "%ld", budget);
+
+    n = 0;
+    args[n++] = argv[optind];
+    if (hash) {
+        args[n++] = "-t";
+    }
+    args[n++] = "-x";
+    args[n++] = budget_arg;
+    args[n] = text;
+    args[n + 1] = NULL;
+    ok_file = run(args, NULL, got_file);
+    args[n] = NULL;
+    ok_stdin = run(args, text, got_stdin);
+    spill_rss = children_rss();
+
+    args[1] = "-r";
+    args[2] = "-i";
+    args[3] = text;
+    args[4] = NULL;
+    ok_memory = run(args, NULL, want);
+    memory_rss = children_rss();
+    same_file = ok_file && ok_memory && same_files(want, got_file);
+    same_stdin = ok_stdin && ok_memory && same_files(want, got_stdin);
+
+    passed = ok_file && ok_stdin && ok_memory && same_file && same_stdin
+        && spill_rss <= (budget + allowance) * 1024;
+    printf("{\"hash\":%s,\"budget_mb\":%ld,\"allowance_mb\":%ld,\"input_mb\":%ld,"
+           "\"spill_max_rss_mb\":%.1f,\"in_memory_max_rss_mb\":%.1f,"
+           "\"same_output_file\":%s,\"same_output_stdin\":%s,\"passed\":%s}\n",
+           hash ? "true" : "false", budget, allowance, INPUT_FACTOR * budget, spill_rss / 1024.0,
+           memory_rss / 1024.0, same_file ? "true" : "false",
+           same_stdin ? "true" : "false", passed ? "true" : "false");
+
+    remove(text);
+    remove(want);
+    remove(got_file);
+    remove(got_stdin);
+    free(text);
+    free(want);
+    free(got_file);
+    free(got_stdin);
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
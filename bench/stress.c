@@ -0,0 +1,239 @@
+/**
+ * @file stress.c
+ *
+ * This program stresses a shared tree, see tree_share(), by filling it
+ * with the words of a text file from several writer threads while reader
+ * threads look up random words of the same file as fast as they can. A
+ * reader checks that the frequency it sees for a word never goes down,
+ * since words are only ever added. Once the writers have finished the
+ * tree is checked with tree_valid(), and the frequency of every word is
+ * compared with a tree filled from the same words by a single thread.
+ * One line of JSON giving the insert and lookup rates and the result of
+ * the checks is printed to stdout, and the exit status is non-zero if
+ * any check failed.
+ *
+ * Build it from the top of the repository with
+ *
+ *    gcc -O2 -W -Wall -ansi -pedantic -pthread -Iasgn bench/stress.c \
+ *        asgn/tree.c asgn/mylib.c -o tree-stress
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+#include "tree.h"
+#include "mylib.h"
+
+/**
+ * Define:
+ * WORD_SIZE is the longest word read from the text file, as in asgn2.
+ */
+#define WORD_SIZE 256
+
+/**
+ * A stress job is one thread's part of the run. A writer inserts the
+ * words from first up to last; a reader looks up random words until the
+ * writers are done, remembering the frequency it last saw at each
+ * position of the file in seen.
+ */
+struct stress_job {
+    pthread_t id;
+    int first;
+    int last;
+    unsigned long rng_state;
+    int *seen;
+    long lookups;
+    long backwards;
+};
+
+static tree shared;
+static char **words;
+static int n_words = 0;
+static volatile int writing = 1;
+
+/**
+ * Function:
+ * A small xorshift random number generator, as in bench.c, with a state
+ * of its own for each reader.
+ * @return the next pseudo-random 32-bit number
+ */
+
+static unsigned long rng_next(unsigned long *state) {
+    *state ^= (*state << 13) & 0xFFFFFFFFUL;
+    *state ^= *state >> 17;
+    *state ^= (*state << 5) & 0xFFFFFFFFUL;
+    return *state & 0xFFFFFFFFUL;
+}
+
+static double wall_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *writer_main(void *arg) {
+    struct stress_job *job = arg;
+    int i;
+    for (i = job->first; i < job->last; i++) {
+        tree_insert(shared, words[i]);
+    }
+    return NULL;
+}
+
+static void *reader_main(void *arg) {
+    struct stress_job *job = arg;
+    int i, freq;
+    while (writing) {
+        i = rng_next(&job->rng_state) % n_words;
+        freq = tree_frequency(shared, words[i]);
+        if (freq < job->seen[i]) {
+            job->backwards++;
+        }
+        job->seen[i] = freq;
+        job->lookups++;
+    }
+    return NULL;
+}
+
+static void print_usage(char *progname) {
+    fprintf(stderr, "Usage: %s [OPTION]... FILENAME\n", progname);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Fill a shared tree with the words of FILENAME from several threads\nwhile others look words up, then check the tree, printing the results\nas JSON to stdout.\n\n");
+    fprintf(stderr, "-b\t\tUse a BST instead of an RBT\n");
+    fprintf(stderr, "-n WORDS\tUse at most the first WORDS words of FILENAME\n");
+    fprintf(stderr, "-r READERS\tThreads looking words up (default 4)\n");
+    fprintf(stderr, "-t\t\tUse a hash table instead of an RBT\n");
+    fprintf(stderr, "-w WRITERS\tThreads inserting words (default 2)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "-h\t\tPrint this message\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *optstring = "bn:r:tw:h";
+    struct stress_job *jobs;
+    tree_t type = RBT;
+    tree expected;
+    arena strings;
+    tokenizer tk;
+    FILE *in;
+    char *word;
+    double start, seconds;
+    long lookups = 0, backwards = 0;
+    int option, readers = 4, writers = 2, limit = -1, size = 1024;
+    int i, freq, valid, wrong = 0;
+
+    while ((option = getopt(argc, argv, optstring)) != EOF) {
+        switch (option) {
+            case 'b':
+                type = BST;
+                break;
+            case 'n':
+                limit = atoi(optarg);
+                break;
+            case 'r':
+                readers = atoi(optarg);
+                break;
+            case 't':
+                type = HASH;
+                break;
+            case 'w':
+                writers = atoi(optarg);
+                break;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind != 1 || readers < 0 || writers < 1) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (NULL == (in = fopen(argv[optind], "r"))) {
+        fprintf(stderr, "Can't find file %s\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+    strings = arena_new(1 << 20);
+    words = emalloc(size * sizeof words[0]);
+    tk = tokenizer_open(in, WORD_SIZE);
+    while (n_words != limit && tokenizer_next(tk, &word) != EOF) {
+        if (n_words == size) {
+            size *= 2;
+            words = erealloc(words, size * sizeof words[0]);
+        }
+        words[n_words++] = arena_strdup(strings, word);
+    }
+    tokenizer_free(tk);
+    fclose(in);
+    if (n_words == 0) {
+        fprintf(stderr, "No words in %s\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    shared = tree_new(type);
+    tree_share(shared);
+    jobs = emalloc((readers + writers) * sizeof jobs[0]);
+    for (i = 0; i < readers; i++) {
+        jobs[i].rng_state = (88172645UL + 2 * i) | 1;
+        jobs[i].seen = emalloc(n_words * sizeof jobs[i].seen[0]);
+        memset(jobs[i].seen, 0, n_words * sizeof jobs[i].seen[0]);
+        jobs[i].lookups = 0;
+        jobs[i].backwards = 0;
+        if (pthread_create(&jobs[i].id, NULL, reader_main, &jobs[i]) != 0) {
+            fprintf(stderr, "Failed to create thread\n");
+            return EXIT_FAILURE;
+        }
+    }
+    start = wall_time();
+    for (i = 0; i < writers; i++) {
+        jobs[readers + i].first = (int)((double)n_words * i / writers);
+        jobs[readers + i].last = (int)((double)n_words * (i + 1) / writers);
+        if (pthread_create(&jobs[readers + i].id, NULL, writer_main,
+                           &jobs[readers + i]) != 0) {
+            fprintf(stderr, "Failed to create thread\n");
+            return EXIT_FAILURE;
+        }
+    }
+    for (i = 0; i < writers; i++) {
+        pthread_join(jobs[readers + i].id, NULL);
+    }
+    seconds = wall_time() - start;
+    writing = 0;
+    for (i = 0; i < readers; i++) {
+        pthread_join(jobs[i].id, NULL);
+        lookups += jobs[i].lookups;
+        backwards += jobs[i].backwards;
+        free(jobs[i].seen);
+    }
+
+    valid = tree_valid(shared);
+    expected = tree_new(type);
+    for (i = 0; i < n_words; i++) {
+        tree_insert(expected, words[i]);
+    }
+    for (i = 0; i < tree_size(expected); i++) {
+        word = tree_word(expected, i, &freq);
+        wrong += tree_frequency(shared, word) != freq;
+    }
+    wrong += tree_size(shared) != tree_size(expected);
+
+    printf("{\"type\":\"%s\",\"words\":%d,\"distinct\":%d,\"writers\":%d,"
+           "\"readers\":%d,\"seconds\":%.3f,\"inserts_per_sec\":%.0f,"
+           "\"lookups_per_sec\":%.0f,\"valid\":%s,\"wrong_frequencies\":%d,"
+           "\"backwards_reads\":%ld}\n",
+           type == BST ? "bst" : type == RBT ? "rbt" : "hash", n_words,
+           tree_size(shared), writers, readers, seconds, n_words / seconds,
+           lookups / seconds, valid ? "true" : "false", wrong, backwards);
+
+    tree_free(expected);
+    tree_free(shared);
+    free(jobs);
+    free(words);
+    arena_free(strings);
+    return (valid && wrong == 0 && backwards == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,396 @@
+/**
+ * @file tokcheck.c
+ *
+ * This program checks that the tokenizer in mylib.c splits text into
+ * exactly the words getword() does, with each of its scalar, SSE2 and
+ * AVX2 kernels the CPU can run, see tokenizer_kernels(). Every text is
+ * split with getword() once for each word limit, and then by a tokenizer
+ * over the text in memory, by one reading it from a pipe in blocks and by
+ * one mapping it from a file a piece at a time, and the words are
+ * compared in order.
+ *
+ * The texts are the files named on the command line, then generated ones:
+ * random text mixing letters, digits, apostrophes, punctuation next to
+ * the letter and digit ranges and bytes of 0x80 and up, a sweep of words
+ * of every length up to 70 after every amount of padding up to 33 bytes,
+ * so words cross the 16 and 32 byte steps of the kernels at every offset,
+ * and words and apostrophes around the edges of a tokenizer's 1 MB blocks
+ * and 4 MB mapped pieces.
+ * Word limits of 2, 5, 17, 33 and 256 split words at many lengths too.
+ *
+ * One line of JSON giving the counts is printed to stdout, and the first
+ * few differences to stderr. The exit status is non-zero if there were
+ * any.
+ *
+ * Build it from the top of the repository with
+ *
+ *    gcc -O2 -W -Wall -ansi -pedantic -Iasgn bench/tokcheck.c \
+ *        asgn/mylib.c -o tree-tokcheck
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "mylib.h"
+
+/**
+ * Define:
+ * BLOCK_SIZE is the size of the blocks a tokenizer reads a stream in, and
+ * MAP_SIZE of the pieces it maps a file in, TOKENIZER_BLOCK_SIZE and
+ * TOKENIZER_MAP_SIZE in mylib.c. RANDOM_SIZE is the length of the random
+ * text, and MAX_REPORTS the most differences printed.
+ */
+#define BLOCK_SIZE (1 << 20)
+#define MAP_SIZE (4 << 20)
+#define RANDOM_SIZE (6 << 20)
+#define MAX_REPORTS 10
+
+/**
+ * The words split from a text, each followed by a newline.
+ */
+struct words {
+    char *buf;
+    size_t len;
+    size_t size;
+    long n;
+};
+
+/**
+ * The ways a tokenizer is given a text.
+ */
+enum { IN_MEMORY, STREAMED, MAPPED };
+
+static const char *kernels[] = { "scalar", "sse2", "avx2" };
+static const char *ways[] = { "in memory", "streamed", "mapped" };
+static const int limits[] = { 2, 5, 17, 33, 256 };
+
+static long cases = 0;
+static long compared = 0;
+static long mismatches = 0;
+
+static unsigned long rng_state = 88172645UL;
+
+/**
+ * Function:
+ * A small xorshift random number generator.
+ * @return the next pseudo-random 32-bit number
+ */
+
+static unsigned long rng_next(void) {
+    rng_state ^= (rng_state << 13) & 0xFFFFFFFFUL;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= (rng_state << 5) & 0xFFFFFFFFUL;
+    return rng_state & 0xFFFFFFFFUL;
+}
+
+static void words_add(struct words *w, const char *word, int len) {
+    while (w->len + len + 1 > w->size) {
+        w->size = (w->size == 0) ? 1 << 16 : 2 * w->size;
+        w->buf = erealloc(w->buf, w->size);
+    }
+    memcpy(w->buf + w->len, word, len);
+    w->len += len;
+    w->buf[w->len++] = '\n';
+    w->n++;
+}
+
+/**
+ * Function:
+ * Opens a pipe which a child process fills with text, so that a tokenizer
+ * reading it can't map it and has to read it in blocks.
+ * @return the read end of the pipe as a stream
+ */
+
+static FILE *pipe_text(const char *text, size_t len) {
+    int fds[2];
+    size_t sent;
+    ssize_t got;
+    if (pipe(fds) != 0) {
+        fprintf(stderr, "Can't make a pipe\n");
+        exit(EXIT_FAILURE);
+    }
+    switch (fork()) {
+        case -1:
+            fprintf(stderr, "Can't fork\n");
+            exit(EXIT_FAILURE);
+        case 0:
+            close(fds[0]);
+            for (sent = 0; sent < len; sent += got) {
+                if ((got = write(fds[1], text + sent, len - sent)) <= 0) {
+                    _exit(EXIT_FAILURE);
+                }
+            }
+            _exit(EXIT_SUCCESS);
+    }
+    close(fds[1]);
+    return fdopen(fds[0], "r");
+}
+
+static void split_getword(const char *text, size_t len, int limit, struct words *w) {
+    FILE *stream = fmemopen((char *)text, len, "r");
+    char *word = emalloc(limit);
+    int n;
+    if (NULL == stream) {
+        fprintf(stderr, "Can't open a text as a stream\n");
+        exit(EXIT_FAILURE);
+    }
+    while ((n = getword(word, limit, stream)) != EOF) {
+        words_add(w, word, n);
+    }
+    free(word);
+    fclose(stream);
+}
+
+/**
+ * Function:
+ * Writes a text to a temporary file, which a tokenizer reading it maps.
+ * @return the file, rewound to its start
+ */
+
+static FILE *file_text(const char *text, size_t len) {
+    FILE *file = tmpfile();
+    if (NULL == file || fwrite(text, 1, len, file) != len || fflush(file) != 0) {
+        fprintf(stderr, "Can't write a temporary file\n");
+        exit(EXIT_FAILURE);
+    }
+    rewind(file);
+    return file;
+}
+
+static void split_tokenizer(const char *text, size_t len, int limit, int way,
+                            struct words *w) {
+    FILE *stream = NULL;
+    tokenizer tk;
+    char *word;
+    int n;
+    if (way == STREAMED) {
+        stream = pipe_text(text, len);
+        tk = tokenizer_open(stream, limit);
+    } else if (way == MAPPED) {
+        stream = file_text(text, len);
+        tk = tokenizer_open(stream, limit);
+    } else {
+        tk = tokenizer_new((char *)text, len, limit);
+    }
+    while ((n = tokenizer_next(tk, &word)) != EOF) {
+        words_add(w, word, n);
+    }
+    tokenizer_free(tk);
+    if (stream != NULL) {
+        fclose(stream);
+    }
+    if (way == STREAMED) {
+        wait(NULL);
+    }
+}
+
+static int word_len(struct words *w, size_t start) {
+    size_t end = start;
+    while (end < w->len && w->buf[end] != '\n') {
+        end++;
+    }
+    return (int)(end - start);
+}
+
+/**
+ * Function:
+ * Reports where two lists of words first differ.
+ */
+
+static void report(const char *name, const char *kernel, int limit, int way,
+                   struct words *want, struct words *got) {
+    size_t i = 0, line = 0, start = 0;
+    size_t n = want->len < got->len ? want->len : got->len;
+    int want_len, got_len;
+    if (++mismatches > MAX_REPORTS) {
+        return;
+    }
+    for (i = 0; i < n && want->buf[i] == got->buf[i]; i++) {
+        if (want->buf[i] == '\n') {
+            line++;
+            start = i + 1;
+        }
+    }
+    want_len = word_len(want, start);
+    got_len = word_len(got, start);
+    fprintf(stderr, "%s: %s kernel, limit %d, %s: word %lu differs, "
+            "getword() gave \"%.*s\" but the tokenizer \"%.*s\"\n",
+            name, kernel, limit, ways[way],
+            (unsigned long)line, want_len, want->buf + start, got_len, got->buf + start);
+}
+
+/**
+ * Function:
+ * Checks one text with every kernel and limit, given to a tokenizer in
+ * memory and, if files is set, from a pipe and a file too.
+ */
+
+static void check(const char *name, const char *text, size_t len, int files) {
+    struct words want = { NULL, 0, 0, 0 }, got = { NULL, 0, 0, 0 };
+    size_t k, l;
+    int way;
+
+    cases++;
+    for (l = 0; l < sizeof limits / sizeof limits[0]; l++) {
+        want.len = want.n = 0;
+        split_getword(text, len, limits[l], &want);
+        for (k = 0; k < sizeof kernels / sizeof kernels[0]; k++) {
+            if (tokenizer_kernels(kernels[k]) == EOF) {
+                continue;
+            }
+            for (way = IN_MEMORY; way <= (files ? MAPPED : IN_MEMORY); way++) {
+                got.len = got.n = 0;
+                split_tokenizer(text, len, limits[l], way, &got);
+                compared += want.n;
+                if (got.len != want.len || memcmp(got.buf, want.buf, want.len) != 0) {
+                    report(name, kernels[k], limits[l], way, &want, &got);
+                }
+            }
+        }
+    }
+    free(want.buf);
+    free(got.buf);
+}
+
+/**
+ * Function:
+ * Returns a random byte, mostly letters of either case with some digits,
+ * spaces, apostrophes, the characters either side of the letter and digit
+ * ranges, and bytes of 0x80 and up.
+ */
+
+static int random_byte(void) {
+    static const char edges[] = "/:@[`{ \n\t.,-";
+    unsigned long r = rng_next() % 100;
+    if (r < 55) {
+        return ((rng_next() & 1) ? 'a' : 'A') + rng_next() % 26;
+    } else if (r < 63) {
+        return '0' + rng_next() % 10;
+    } else if (r < 70) {
+        return '\'';
+    } else if (r < 78) {
+        return 0x80 + rng_next() % 128;
+    }
+    return edges[rng_next() % (sizeof edges - 1)];
+}
+
+static void check_random(void) {
+    char *text = emalloc(RANDOM_SIZE);
+    size_t i = 0, run;
+    int c;
+    while (i < RANDOM_SIZE) {
+        /* Runs of one byte let words and gaps grow past 16 and 32 bytes. */
+        c = random_byte();
+        run = (rng_next() % 4 == 0) ? 1 + rng_next() % 80 : 1;
+        while (run-- > 0 && i < RANDOM_SIZE) {
+            text[i++] = (c >= 'a' && c <= 'z' && rng_next() % 3 == 0) ? random_byte() : c;
+        }
+    }
+    check("random text", text, RANDOM_SIZE, 1);
+    free(text);
+}
+
+static void check_sweep(void) {
+    char text[128];
+    char name[64];
+    int pad, len, i, n;
+    for (pad = 0; pad <= 33; pad++) {
+        for (len = 1; len <= 70; len++) {
+            n = 0;
+            for (i = 0; i < pad; i++) {
+                text[n++] = (i % 3 == 0) ? (char)0xE9 : ' ';
+            }
+            for (i = 0; i < len; i++) {
+                text[n++] = (i == (pad + len) % len && i > 0) ? '\'' : 'A' + (i * 7 + pad) % 26;
+            }
+            text[n++] = '\'';
+            text[n++] = (char)0xC3;
+            text[n++] = 'z';
+            sprintf(name, "sweep pad %d length %d", pad, len);
+            check(name, text, n, 0);
+        }
+    }
+}
+
+static void check_block_edge(const char *what, size_t edge) {
+    char *text = emalloc(edge + 64);
+    char name[64];
+    size_t i, n = edge + 64;
+    int off;
+    for (off = -3; off <= 3; off++) {
+        for (i = 0; i < n; i++) {
+            text[i] = (i % 11 == 10) ? ' ' : 'a' + i % 26;
+        }
+        /* A word straddles the edge, with an apostrophe near it. */
+        for (i = edge - 40; i < edge + 40; i++) {
+            text[i] = 'B';
+        }
+        text[edge + off] = '\'';
+        sprintf(name, "%s edge apostrophe %+d", what, off);
+        check(name, text, n, 1);
+        text[edge + off] = ' ';
+        sprintf(name, "%s edge space %+d", what, off);
+        check(name, text, n, 1);
+    }
+    free(text);
+}
+
+static char *read_file(const char *path, size_t *len) {
+    FILE *in = fopen(path, "rb");
+    size_t size = 1 << 16, n;
+    char *text;
+    if (NULL == in) {
+        return NULL;
+    }
+    text = emalloc(size);
+    *len = 0;
+    while ((n = fread(text + *len, 1, size - *len, in)) > 0) {
+        *len += n;
+        if (*len == size) {
+            size *= 2;
+            text = erealloc(text, size);
+        }
+    }
+    fclose(in);
+    return text;
+}
+
+int main(int argc, char *argv[]) {
+    size_t k, len;
+    char *text;
+    int i, n_kernels = 0;
+
+    if (argc > 1 && argv[1][0] == '-') {
+        fprintf(stderr, "Usage: %s [CORPUS]...\n", argv[0]);
+        fprintf(stderr, "\n");
+        fprintf(stderr, "Check that each tokenizer kernel splits the CORPUS files and generated\ntexts into the same words as getword(), printing the results as JSON\nto stdout.\n");
+        return EXIT_FAILURE;
+    }
+    for (i = 1; i < argc; i++) {
+        if (NULL == (text = read_file(argv[i], &len))) {
+            fprintf(stderr, "Can't find file %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        check(argv[i], text, len, 1);
+        free(text);
+    }
+    check_random();
+    check_sweep();
+    check_block_edge("block", BLOCK_SIZE);
+    check_block_edge("map", MAP_SIZE);
+
+    printf("{\"kernels\":[");
+    for (k = 0; k < sizeof kernels / sizeof kernels[0]; k++) {
+        if (tokenizer_kernels(kernels[k]) == 0) {
+            printf("%s\"%s\"", n_kernels++ > 0 ? "," : "", kernels[k]);
+        }
+    }
+    printf("],\"texts\":%ld,\"words_compared\":%ld,\"mismatches\":%ld}\n",
+           cases, compared, mismatches);
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}